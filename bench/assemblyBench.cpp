@@ -0,0 +1,174 @@
+#include "bench.h"
+
+#include "fitting/matrixAssembly.h"
+
+#include <cmath>
+#include <random>
+#include <iostream>
+#include <algorithm>
+
+namespace
+{
+    struct Border
+    {
+        std::vector< size_t > columns;
+        std::vector< F64 > coefficients;
+    };
+
+    // a restraint or constraint on two random parameters
+    Border RandomBorder( std::mt19937_64 &rng, size_t numColumns )
+    {
+        std::uniform_int_distribution< size_t > column( 0, numColumns - 1 );
+        std::uniform_real_distribution< F64 > coefficient( 0.5, 1.5 );
+
+        Border border;
+        border.columns = { column( rng ), column( rng ) };
+        border.coefficients = { coefficient( rng ), coefficient( rng ) };
+
+        return border;
+    }
+
+    template< class Assembly >
+    void Assemble( Assembly &assembly, const std::vector< arma::mat > &blocks, const std::vector< Border > &restraints,
+                   const std::vector< Border > &constraints, size_t numColumns )
+    {
+        for ( size_t b=0; b < blocks.size(); ++b )
+        {
+            assembly.AddBlock( b * blocks[b].n_cols, blocks[b] );
+        }
+
+        for ( const Border &restraint : restraints )
+        {
+            for ( size_t i=0; i < restraint.columns.size(); ++i )
+            {
+                for ( size_t j=0; j < restraint.columns.size(); ++j )
+                {
+                    assembly.Add( restraint.columns[i], restraint.columns[j], restraint.coefficients[i] * restraint.coefficients[j] );
+                }
+            }
+        }
+
+        size_t row = numColumns;
+
+        for ( const Border &constraint : constraints )
+        {
+            for ( size_t c=0; c < constraint.columns.size(); ++c )
+            {
+                assembly.Add( row, constraint.columns[c], constraint.coefficients[c] );
+                assembly.Add( constraint.columns[c], row, constraint.coefficients[c] );
+            }
+
+            row++;
+        }
+
+        assembly.Finish();
+    }
+
+    F64 MaxRelative( const arma::sp_mat &sparse, const arma::mat &dense )
+    {
+        return arma::abs( arma::mat( sparse ) - dense ).max() / arma::abs( dense ).max();
+    }
+}
+
+/*
+**  usage: assembly [blocks] [columns] [constraints]
+**
+**  Assembles bordered normal equations with random blocks on the diagonal, a restraint per block and
+**  the given number of constraints, like Fitter::AddMatrix does. They are built as the dense matrix of
+**  FieldFit, with the element-wise insertions FieldFitSparse used before and from triplets, and the
+**  sparse matrices are compared against the dense one.
+*/
+int FieldFitBench::Assembly( const std::vector< std::string > &args )
+{
+    const size_t numBlocks = args.size() > 0 ? std::stoul( args[0] ) : 200;
+    const size_t blockColumns = args.size() > 1 ? std::stoul( args[1] ) : 20;
+    const size_t numConstraints = args.size() > 2 ? std::stoul( args[2] ) : 200;
+
+    const size_t numColumns = numBlocks * blockColumns;
+    const size_t size = numColumns + numConstraints;
+
+    std::mt19937_64 rng( 42 );
+
+    std::vector< arma::mat > blocks( numBlocks );
+
+    for ( arma::mat &block : blocks )
+    {
+        const arma::mat random = arma::randu( blockColumns, blockColumns );
+        block = random.t() * random;
+    }
+
+    std::vector< Border > restraints, constraints;
+
+    for ( size_t i=0; i < numBlocks; ++i )
+    {
+        restraints.push_back( RandomBorder( rng, numColumns ) );
+    }
+
+    for ( size_t i=0; i < numConstraints; ++i )
+    {
+        constraints.push_back( RandomBorder( rng, numColumns ) );
+    }
+
+    const size_t nonZeros = numBlocks * blockColumns * blockColumns + restraints.size() * 4 + constraints.size() * 4;
+
+    arma::mat dense;
+
+    const F64 tDense = Time( [&]() {
+        FieldFit::DenseAssembly assembly( dense, size, nonZeros );
+        Assemble( assembly, blocks, restraints, constraints, numColumns );
+    });
+
+    // the path FieldFitSparse used, every entry is inserted into the compressed columns on its own
+    arma::sp_mat inserted;
+
+    const F64 tInserted = Time( [&]() {
+        inserted.zeros( size, size );
+
+        for ( size_t b=0; b < numBlocks; ++b )
+        {
+            inserted.submat( b * blockColumns, b * blockColumns, ( b + 1 ) * blockColumns - 1, ( b + 1 ) * blockColumns - 1 ) = blocks[b];
+        }
+
+        for ( const Border &restraint : restraints )
+        {
+            for ( size_t i=0; i < restraint.columns.size(); ++i )
+            {
+                for ( size_t j=0; j < restraint.columns.size(); ++j )
+                {
+                    inserted.row( restraint.columns[i] )[ restraint.columns[j] ] += restraint.coefficients[i] * restraint.coefficients[j];
+                }
+            }
+        }
+
+        size_t row = numColumns;
+
+        for ( const Border &constraint : constraints )
+        {
+            for ( size_t c=0; c < constraint.columns.size(); ++c )
+            {
+                inserted.row( row )[ constraint.columns[c] ] += constraint.coefficients[c];
+                inserted.col( row )[ constraint.columns[c] ] += constraint.coefficients[c];
+            }
+
+            row++;
+        }
+    });
+
+    arma::sp_mat triplets;
+
+    const F64 tTriplets = Time( [&]() {
+        FieldFit::SparseAssembly assembly( triplets, size, nonZeros );
+        Assemble( assembly, blocks, restraints, constraints, numColumns );
+    });
+
+    const F64 insertedRelative = MaxRelative( inserted, dense );
+    const F64 tripletsRelative = MaxRelative( triplets, dense );
+
+    std::cout << "matrix:          " << size << " x " << size << ", " << triplets.n_nonzero << " non zeros" << std::endl;
+    std::cout << "dense      (s):  " << tDense << ", " << FieldFit::DenseAssembly::Bytes( size, nonZeros ) / F64( 1 << 20 ) << " MB" << std::endl;
+    std::cout << "inserted   (s):  " << tInserted << ", max relative difference " << insertedRelative << std::endl;
+    std::cout << "triplets   (s):  " << tTriplets << ", max relative difference " << tripletsRelative << ", "
+              << FieldFit::SparseAssembly::Bytes( size, nonZeros ) / F64( 1 << 20 ) << " MB" << std::endl;
+
+    return std::max( insertedRelative, tripletsRelative ) < 1e-15 ? 0 : 1;
+}
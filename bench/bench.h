@@ -0,0 +1,34 @@
+#pragma once
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include "common/types.h"
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+namespace FieldFitBench
+{
+    // every benchmark takes the remaining command line arguments
+    typedef int ( *BenchFunction )( const std::vector< std::string > &args );
+
+    int NumberParser( const std::vector< std::string > &args );
+
+    int Kernel( const std::vector< std::string > &args );
+
+    int Assembly( const std::vector< std::string > &args );
+
+    // the seconds a call of function takes
+    template< class Function >
+    F64 Time( Function function )
+    {
+        auto t0 = std::chrono::high_resolution_clock::now();
+        function();
+        auto t1 = std::chrono::high_resolution_clock::now();
+
+        return std::chrono::duration_cast< std::chrono::duration< F64 > >( t1 - t0 ).count();
+    }
+}
+
+#endif
@@ -0,0 +1,123 @@
+#include "bench.h"
+
+#include "fitting/delcomp.h"
+
+#include "common/util.h"
+
+#include <cmath>
+#include <random>
+#include <iostream>
+#include <algorithm>
+
+/*
+**  usage: kernel [points] [repeats]
+**
+**  Fills the columns of a charge|dipole|qpol site on a random grid, once with a DelComp call per
+**  fit type and once with the fused DelCompSite for each supported instruction set, and reports the
+**  largest relative difference. The mixed precision kernel of the widest instruction set is timed
+**  as well, its difference is reported separately and does not fail the run.
+*/
+int FieldFitBench::Kernel( const std::vector< std::string > &args )
+{
+    const size_t numPoints = args.size() > 0 ? std::stoul( args[0] ) : 100000;
+    const size_t repeats = args.size() > 1 ? std::stoul( args[1] ) : 20;
+
+    std::mt19937_64 rng( 42 );
+    std::uniform_real_distribution< F64 > coord( -8.0, 8.0 );
+
+    arma::vec x( numPoints ), y( numPoints ), z( numPoints );
+
+    for ( size_t i=0; i < numPoints; ++i )
+    {
+        x[i] = coord( rng );
+        y[i] = coord( rng );
+        z[i] = coord( rng );
+    }
+
+    const F64 posX = 0.1, posY = -0.2, posZ = 0.3;
+
+    arma::mat reference( numPoints, FieldFit::FitType::size );
+    arma::mat fused( numPoints, FieldFit::FitType::size );
+
+    const F64 tReference = Time( [&]() {
+        for ( size_t r=0; r < repeats; ++r )
+        {
+            for ( S32 t=0; t < FieldFit::FitType::size; ++t )
+            {
+                reference.col( t ) = FieldFit::DelComp( posX, posY, posZ, x, y, z, ( FieldFit::FitType ) t );
+            }
+        }
+    });
+
+    F64 *columns[ FieldFit::FitType::size ];
+
+    for ( S32 t=0; t < FieldFit::FitType::size; ++t )
+    {
+        columns[t] = fused.colptr( t );
+    }
+
+    const F64 perPoint = 1e9 / F64( numPoints * repeats );
+
+    std::cout << "points:               " << numPoints << " x " << repeats << std::endl;
+    std::cout << "DelComp     (ns/pnt): " << tReference * perPoint << std::endl;
+
+    F64 maxRelative = 0.0;
+
+    // every instruction set up to the widest supported one
+    for ( S32 isa = FieldFit::KernelIsa::scalar; isa <= FieldFit::DetectKernelIsa(); ++isa )
+    {
+        FieldFit::SetKernelIsa( ( FieldFit::KernelIsa ) isa );
+
+        const F64 tFused = Time( [&]() {
+            for ( size_t r=0; r < repeats; ++r )
+            {
+                FieldFit::DelCompSite( posX, posY, posZ, x.memptr(), y.memptr(), z.memptr(), numPoints, columns );
+            }
+        });
+
+        for ( size_t i=0; i < reference.n_elem; ++i )
+        {
+            maxRelative = std::max( maxRelative, std::fabs( fused[i] - reference[i] ) / std::max( std::fabs( reference[i] ), 1e-300 ) );
+        }
+
+        std::cout << "DelCompSite " << Util::PostWhiteSpace( FieldFit::EnumToString( ( FieldFit::KernelIsa ) isa ), 7 )
+                  << "(ns/pnt): " << tFused * perPoint << ", speedup " << tReference / tFused << std::endl;
+    }
+
+    FieldFit::SetKernelIsa( FieldFit::DetectKernelIsa() );
+
+    // a charge site only needs 1/r
+    F64 *charge[ FieldFit::FitType::size ] = { fused.colptr( FieldFit::FitType::charge ) };
+
+    const F64 tCharge = Time( [&]() {
+        for ( size_t r=0; r < repeats; ++r )
+        {
+            FieldFit::DelCompSite( posX, posY, posZ, x.memptr(), y.memptr(), z.memptr(), numPoints, charge );
+        }
+    });
+
+    std::cout << "DelCompSite charge (ns/pnt): " << tCharge * perPoint << std::endl;
+
+    const F64 tMixed = Time( [&]() {
+        for ( size_t r=0; r < repeats; ++r )
+        {
+            FieldFit::DelCompSite( posX, posY, posZ, x.memptr(), y.memptr(), z.memptr(), numPoints, columns, true );
+        }
+    });
+
+    // relative to the largest value of the column, single precision cannot resolve the cancellations near its zeros
+    F64 mixedRelative = 0.0;
+
+    for ( S32 t=0; t < FieldFit::FitType::size; ++t )
+    {
+        const F64 scale = arma::abs( reference.col( t ) ).max();
+
+        mixedRelative = std::max( mixedRelative, arma::abs( fused.col( t ) - reference.col( t ) ).max() / scale );
+    }
+
+    std::cout << "DelCompSite mixed  (ns/pnt): " << tMixed * perPoint << ", max relative difference " << mixedRelative << std::endl;
+
+    std::cout << "max relative difference: " << maxRelative << std::endl;
+
+    return maxRelative < 1e-13 ? 0 : 1;
+}
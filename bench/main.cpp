@@ -0,0 +1,31 @@
+#include "bench.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <iostream>
+
+int main(int argc, char** argv)
+{
+    std::map< std::string, FieldFitBench::BenchFunction > benchmarks;
+    benchmarks.insert( std::make_pair( "parse", &FieldFitBench::NumberParser ) );
+    benchmarks.insert( std::make_pair( "kernel", &FieldFitBench::Kernel ) );
+    benchmarks.insert( std::make_pair( "assembly", &FieldFitBench::Assembly ) );
+
+    if ( argc < 2 || benchmarks.find( argv[1] ) == benchmarks.end() )
+    {
+        std::cerr << "usage: " << argv[0] << " <benchmark> [args]" << std::endl;
+        std::cerr << "benchmarks:" << std::endl;
+
+        for ( auto it = benchmarks.begin(), itend = benchmarks.end(); it != itend; ++it )
+        {
+            std::cerr << "    " << it->first << std::endl;
+        }
+
+        return 1;
+    }
+
+    const std::vector< std::string > args( argv + 2, argv + argc );
+
+    return benchmarks[ argv[1] ]( args );
+}
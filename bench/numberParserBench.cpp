@@ -0,0 +1,186 @@
+#include "bench.h"
+
+#include "common/util.h"
+
+#include "io/block.h"
+#include "io/tokenizer.h"
+#include "io/mappedFile.h"
+#include "io/numberParser.h"
+
+#include <cmath>
+#include <random>
+#include <memory>
+#include <cstdio>
+#include <cstring>
+#include <stdlib.h>
+#include <iostream>
+
+namespace
+{
+    // 0.157077038013309078E-002, as written by our QM codes
+    std::string FortranFormat( F64 value )
+    {
+        if ( value == 0.0 )
+        {
+            return "0.000000000000000000E+000";
+        }
+
+        S32 exponent = static_cast< S32 >( std::floor( std::log10( std::fabs( value ) ) ) ) + 1;
+        F64 mantissa = value / std::pow( 10.0, exponent );
+
+        char buffer[64];
+        snprintf( buffer, sizeof( buffer ), "%.18f", mantissa );
+
+        // rounding may have pushed the mantissa to 1.0
+        std::string result = buffer;
+        if ( result.find( "1.0" ) == 0 || result.find( "-1.0" ) == 0 )
+        {
+            exponent++;
+            snprintf( buffer, sizeof( buffer ), "%.18f", mantissa / 10.0 );
+            result = buffer;
+        }
+
+        snprintf( buffer, sizeof( buffer ), "E%c%03d", exponent < 0 ? '-' : '+', std::abs( exponent ) );
+
+        return result + buffer;
+    }
+
+    void Synthetic( size_t count, std::string &text )
+    {
+        std::mt19937_64 rng( 42 );
+        std::uniform_real_distribution< F64 > mantissa( -1.0, 1.0 );
+        std::uniform_int_distribution< S32 > exponent( -8, 3 );
+
+        char buffer[64];
+
+        for ( size_t i=0; i < count; ++i )
+        {
+            const F64 value = mantissa( rng ) * std::pow( 10.0, exponent( rng ) );
+
+            switch ( i % 4 )
+            {
+            case 0:
+            case 1:
+                text += FortranFormat( value );
+                break;
+            case 2:
+                snprintf( buffer, sizeof( buffer ), "%.17E", value );
+                text += buffer;
+                break;
+            default:
+                snprintf( buffer, sizeof( buffer ), "%.6f", value );
+                text += buffer;
+                break;
+            }
+
+            text += '\n';
+        }
+    }
+}
+
+/*
+**  usage: parse [count] [field file]
+**
+**  Converts either a synthetic set of tokens or all numeric tokens of a field file through the
+**  old stringstream path, strtod and the NumberParser, and checks the latter bit for bit against strtod.
+*/
+int FieldFitBench::NumberParser( const std::vector< std::string > &args )
+{
+    const size_t count = args.size() > 0 ? std::stoul( args[0] ) : 1000000;
+
+    std::string synthetic;
+    std::shared_ptr< const FieldFit::MappedFile > mapped;
+
+    const char *begin, *end;
+
+    if ( args.size() > 1 )
+    {
+        mapped = std::make_shared< const FieldFit::MappedFile >( args[1] );
+        begin = mapped->Data();
+        end = mapped->End();
+    }
+    else
+    {
+        Synthetic( count, synthetic );
+        begin = synthetic.data();
+        end = synthetic.data() + synthetic.size();
+    }
+
+    FieldFit::Tokenizer tn( " \t;\n\r" );
+    tn.Tokenize( begin, end );
+
+    // only keep the tokens that are numbers in the first place
+    std::vector< FieldFit::Block::Token > tokens;
+    for ( const FieldFit::Block::Token &token : tn.GetBuffer() )
+    {
+        F64 value;
+        if ( token.TryValue( value ) )
+        {
+            tokens.push_back( token );
+        }
+    }
+
+    // the old path received tokens that were already materialized as strings
+    std::vector< std::string > strings;
+    strings.reserve( tokens.size() );
+    for ( const FieldFit::Block::Token &token : tokens )
+    {
+        strings.push_back( token.GetToken() );
+    }
+
+    std::vector< F64 > reference( tokens.size() );
+    std::vector< F64 > stream( tokens.size() );
+    std::vector< F64 > parsed( tokens.size() );
+
+    const F64 tStream = Time( [&]() {
+        for ( size_t i=0; i < strings.size(); ++i )
+        {
+            stream[i] = Util::FromString< F64 >( strings[i] );
+        }
+    });
+
+    const F64 tStrtod = Time( [&]() {
+        for ( size_t i=0; i < strings.size(); ++i )
+        {
+            reference[i] = strtod( strings[i].c_str(), nullptr );
+        }
+    });
+
+    const F64 tParser = Time( [&]() {
+        for ( size_t i=0; i < tokens.size(); ++i )
+        {
+            tokens[i].TryValue( parsed[i] );
+        }
+    });
+
+    size_t mismatches = 0;
+    size_t streamMismatches = 0;
+    for ( size_t i=0; i < tokens.size(); ++i )
+    {
+        if ( memcmp( &parsed[i], &reference[i], sizeof( F64 ) ) != 0 )
+        {
+            if ( mismatches < 10 )
+            {
+                std::cout << "mismatch: " << strings[i] << std::endl;
+            }
+
+            mismatches++;
+        }
+
+        if ( memcmp( &stream[i], &reference[i], sizeof( F64 ) ) != 0 )
+        {
+            streamMismatches++;
+        }
+    }
+
+    const F64 perToken = 1e9 / F64( std::max< size_t >( tokens.size(), 1 ) );
+
+    std::cout << "tokens:               " << tokens.size() << std::endl;
+    std::cout << "stringstream (ns/tok): " << tStream * perToken << std::endl;
+    std::cout << "strtod       (ns/tok): " << tStrtod * perToken << std::endl;
+    std::cout << "NumberParser (ns/tok): " << tParser * perToken << std::endl;
+    std::cout << "speedup vs stringstream: " << tStream / tParser << std::endl;
+    std::cout << "mismatches vs strtod:  NumberParser " << mismatches << ", stringstream " << streamMismatches << std::endl;
+
+    return mismatches == 0 ? 0 : 1;
+}
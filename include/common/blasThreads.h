@@ -0,0 +1,20 @@
+#pragma once
+#ifndef __BLASTHREADS_H__
+#define __BLASTHREADS_H__
+
+#include "common/types.h"
+
+#include <cstddef>
+
+namespace FieldFit
+{
+    /*
+    **  Sets the number of threads of the linked BLAS, when it is one that can be threaded (OpenBLAS,
+    **  MKL or BLIS). While the thread pool runs several systems and blocks at once, each BLAS call
+    **  should stay on its own thread, both to avoid oversubscription and to keep the results independent
+    **  of the thread count. Returns the previous number of threads, or 0 when the BLAS has no such setting.
+    */
+    size_t SetBlasThreads( size_t numThreads );
+}
+
+#endif
@@ -0,0 +1,120 @@
+#pragma once
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include "common/types.h"
+
+#include <queue>
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <future>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+namespace FieldFit
+{
+    /*
+    **  Fixed size pool of worker threads, tasks are started in submission order. A pool of a single
+    **  thread has no workers at all and runs every task directly in Submit. A task that waits for
+    **  tasks it submitted itself should do so through Wait, which runs queued tasks in the meantime,
+    **  so nested work neither deadlocks the pool nor leaves the waiting thread idle.
+    */
+    class ThreadPool
+    {
+    public:
+
+        // 0 uses all available cores
+        ThreadPool( size_t numThreads );
+        ~ThreadPool();
+
+        ThreadPool( const ThreadPool & ) = delete;
+        ThreadPool &operator=( const ThreadPool & ) = delete;
+
+        template< class Function >
+        std::future< typename std::result_of< Function() >::type > Submit( Function function );
+
+        // runs queued tasks on the calling thread until the future is ready, get() then returns at once
+        template< class Result >
+        void Wait( std::future< Result > &future );
+
+        // the same until ready() holds, which is checked with lock held and whenever condition is notified
+        template< class Ready >
+        void Wait( std::unique_lock< std::mutex > &lock, std::condition_variable &condition, Ready ready );
+
+        size_t NumThreads() const;
+
+    private:
+
+        void Run();
+
+        // runs a single queued task, returns false when there was none
+        bool RunPending();
+
+        std::vector< std::thread > mWorkers;
+        std::queue< std::function< void() > > mTasks;
+
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        bool mStopping;
+    };
+
+    template< class Function >
+    std::future< typename std::result_of< Function() >::type > ThreadPool::Submit( Function function )
+    {
+        typedef typename std::result_of< Function() >::type Result;
+
+        // std::function needs a copyable target, so the task itself is shared
+        std::shared_ptr< std::packaged_task< Result() > > task = std::make_shared< std::packaged_task< Result() > >( function );
+        std::future< Result > result = task->get_future();
+
+        if ( mWorkers.empty() )
+        {
+            ( *task )();
+
+            return result;
+        }
+
+        {
+            std::lock_guard< std::mutex > lock( mMutex );
+            mTasks.push( [task]() { ( *task )(); } );
+        }
+
+        mCondition.notify_one();
+
+        return result;
+    }
+
+    template< class Result >
+    void ThreadPool::Wait( std::future< Result > &future )
+    {
+        while ( future.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+        {
+            // the remaining tasks are running on other threads already
+            if ( !RunPending() )
+            {
+                future.wait();
+            }
+        }
+    }
+
+    template< class Ready >
+    void ThreadPool::Wait( std::unique_lock< std::mutex > &lock, std::condition_variable &condition, Ready ready )
+    {
+        while ( !ready() )
+        {
+            lock.unlock();
+            const bool ran = RunPending();
+            lock.lock();
+
+            if ( !ran && !ready() )
+            {
+                condition.wait( lock );
+            }
+        }
+    }
+}
+
+#endif
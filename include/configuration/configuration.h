@@ -24,8 +24,50 @@ namespace FieldFit
         std::vector<System*> & GetSystems();
         const std::vector<System*> & GetSystems() const;
         
+        // build the normal equations of the systems from tiles of their grids, see System::OnUpdate2
+        void SetGramTiles( bool gramTiles );
+        bool GetGramTiles() const;
+        
+        // free the coefficients of the systems once their normal equations are built
+        void SetReleaseCoefficients( bool releaseCoefficients );
+        bool GetReleaseCoefficients() const;
+        
+        // the memory freed by the systems that released their coefficients
+        size_t GetReleasedBytes() const;
+        
+        // approximate the permanent fields with a treecode of this opening angle, 0 sums them directly
+        void SetPermTreeTheta( F64 theta );
+        F64 GetPermTreeTheta() const;
+        
+        // the largest sampled treecode error of all systems
+        F64 GetPermTreeError() const;
+        
+        // evaluate the coefficients in F32, see System::UpdateOptions
+        void SetMixedPrecision( bool mixedPrecision );
+        bool GetMixedPrecision() const;
+        
+        // store the grids and potentials as F32, see System::UpdateOptions
+        void SetCompactStorage( bool compactStorage );
+        bool GetCompactStorage() const;
+        
+        // solve the normal equations per local system, coupled by the constraints, see BlockSolver
+        void SetBlockSolver( bool blockSolver );
+        bool GetBlockSolver() const;
+        
+        // refine the solution against the F64 normal equations until it changes less than this, 0 does not refine
+        void SetRefineTolerance( F64 tolerance );
+        F64 GetRefineTolerance() const;
+        
     private:
         
+        bool mGramTiles;
+        bool mReleaseCoefficients;
+        F64 mPermTreeTheta;
+        bool mMixedPrecision;
+        bool mCompactStorage;
+        bool mBlockSolver;
+        F64 mRefineTolerance;
+
         std::vector<System*> mSystems;
         std::unordered_map< std::string, System*> mNameToSystem; 
     };
@@ -33,6 +33,9 @@ namespace FieldFit
     bool IsSet( U32 flags, FitType type );
     bool IsMultiSet( U32 flags, U32 testValue );
     bool IsSpecialSet( U32 flags, SpecialFlag sf );
+    
+    // the number of fit types in flags, special flags are not counted
+    U32 NumFitTypes( U32 flags );
 }
 
 #endif
\ No newline at end of file
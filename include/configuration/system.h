@@ -6,7 +6,10 @@
 
 #include "configuration/fitType.h"
 
+#include "fitting/permMultipole.h"
+
 #include <set>
+#include <memory>
 #include <string>
 #include <vector>
 #include <armadillo>
@@ -14,6 +17,9 @@
 
 namespace FieldFit
 {
+    class ThreadPool;
+    class PermTree;
+    
     class Site
     {
     public:
@@ -65,26 +71,6 @@ namespace FieldFit
         U32 mTypes;
     };
     
-    class PermSite
-    {
-    public:
-        
-        PermSite( F64 x, F64 y, F64 z, F64 val, FitType type );
-    
-        F64 GetCoordX() const;
-        F64 GetCoordY() const;
-        F64 GetCoordZ() const;
-        F64 GetValue() const;
-        FitType GetType() const;
-        
-    private:
-        F64 mCoordX;
-        F64 mCoordY;
-        F64 mCoordZ;
-        F64 mValue;
-        FitType mType;
-    };
-    
     class Grid
     {
     public:
@@ -93,17 +79,37 @@ namespace FieldFit
               const arma::vec &y,
               const arma::vec &z );
         
+        // uses the memory in place, source keeps it alive
+        Grid( const F64 *x,
+              const F64 *y,
+              const F64 *z,
+              size_t size,
+              const std::shared_ptr< const void > &source );
+        
+        // empty once the grid is compact
         const arma::vec &GetX() const;
         const arma::vec &GetY() const;
         const arma::vec &GetZ() const;
         
-        size_t Size();
+        // the coordinates of the points [begin, begin + numPoints) as F64, in place or converted into buffer when compact
+        void Rows( size_t begin, size_t numPoints, arma::mat &buffer, const F64 *rows[3] ) const;
+        
+        // keeps the coordinates as F32 from here on
+        void Compact();
+        
+        size_t Size() const;
         
     private:
     
+        std::shared_ptr< const void > mSource;
+        
         arma::vec mGridX;
         arma::vec mGridY;
         arma::vec mGridZ;
+        
+        arma::fvec mCompactX;
+        arma::fvec mCompactY;
+        arma::fvec mCompactZ;
     };
     
     class Field
@@ -112,8 +118,20 @@ namespace FieldFit
     
         Field( const arma::mat &mat, const std::set< U32 > &collectionSet, U32 preSelectionNumSets );
         
+        // uses the column major potentials in place, source keeps them alive
+        Field( const F64 *potentials, size_t numPoints, size_t numSets, 
+               const std::set< U32 > &collectionSet, U32 preSelectionNumSets, const std::shared_ptr< const void > &source );
+        
+        // empty once the field is compact
         const arma::mat &GetPotentials() const;
         
+        // the potentials of the points [begin, begin + numPoints) in set, in place or converted into buffer when compact
+        const F64 *ColumnRows( size_t set, size_t begin, size_t numPoints, arma::vec &buffer ) const;
+        
+        // keeps the potentials as F32 from here on
+        void Compact();
+        
+        size_t NumPoints() const;
         U32 NumColumns() const;
 
         U32 PreSelectNumSets() const;
@@ -126,25 +144,49 @@ namespace FieldFit
         // we use this as a consistency check
         U32 mPreSelectionNumSets;
         std::set< U32 > mCollectionSet;
+        std::shared_ptr< const void > mSource;
         arma::mat mPotentials;
+        arma::fmat mCompactPotentials;
     };
     
     class System
     {
     public:
         
+        struct UpdateOptions
+        {
+            UpdateOptions();
+            
+            // X'X and X'y are accumulated from tiles of the grid and the coefficients are not kept
+            bool gramTiles;
+            
+            // the coefficients and permanent field are freed once the normal equations are built
+            bool releaseCoefficients;
+            
+            // above 0 the permanent field is approximated by a treecode with this opening angle
+            F64 permTreeTheta;
+            
+            // the coefficients are evaluated in F32, X'X and X'y are still accumulated in F64, from tiles as with gramTiles
+            bool mixedPrecision;
+            
+            // the grid and potentials are stored as F32 and only converted to F64 per tile
+            bool compactStorage;
+        };
+        
         System( const std::string &name );
         ~System();
         
         //void OnUpdate();
-        void OnUpdate2();
+        
+        // large grids are split into chunks that are built on the pool, independent of its number of threads
+        void OnUpdate2( ThreadPool &pool, const UpdateOptions &options = UpdateOptions() );
         
         Site * FindSite( const std::string &name );
         
         void InsertSite( Site *site );
         void InsertGrid( Grid *grid );
         void InsertField( Field *field );
-        void InsertPermSite( PermSite *site );
+        void InsertPermMultipole( const PermMultipole &multipole );
         
         const std::string &GetName() const; 
         const std::vector< Site* > &GetSites() const;
@@ -152,23 +194,50 @@ namespace FieldFit
         Grid *GetGrid() const;
         Field *GetField() const;
         
-        const F64 ComputeChi2( arma::vec result, size_t collIndex ) const;
+        // chi2 of every collection, with the columns of coefficients as their solutions. From the residuals when
+        // the coefficients are kept, from X'X, X'y and y'y otherwise, after a mixed precision update the model
+        // is evaluated again in F64, in tiles that are shared by all collections
+        arma::vec ComputeChi2( const arma::mat &coefficients ) const;
         const arma::mat &GetLocalXPrimeX() const;
         const arma::mat &PotentialMatrix() const;
         
         size_t NumColumns() const;
         
+        // the memory freed by releaseCoefficients
+        size_t GetReleasedBytes() const;
+        
+        // X'( y - perm - X b ) for every collection, with b the columns of coefficients and X evaluated in F64
+        arma::mat NormalResiduals( const arma::mat &coefficients ) const;
+        
+        // the largest difference between the treecode and direct summation on a sample of the grid
+        F64 GetPermTreeError() const;
+        
     private:
     
         size_t NumberOfColumns() const;
-        arma::vec GeneratePermField() const;
+        // the permanent field at the grid points [begin, begin + numPoints)
+        void GeneratePermField( size_t begin, size_t numPoints, F64 *field ) const;
+        
+        // the permanent field at the grid points [begin, begin + numPoints), generated in buffer when it was released
+        const F64 *PermFieldRows( size_t begin, size_t numPoints, arma::vec &buffer ) const;
+        
+        // the largest difference between the field mPermTree gave the update and direct summation, on gPermTreeSamples grid points
+        F64 SamplePermTreeError() const;
+        
+        // the coefficient rows [begin, begin + numPoints) of all sites, with the columns stride values apart
+        void FillCoefficients( size_t begin, size_t numPoints, F64 *coefficients, size_t stride, bool mixedPrecision ) const;
+        
+        size_t GramTileRows() const;
+        
+        // the normal equations of the grid points [begin, end), built tile by tile
+        void BuildGramChunk( size_t begin, size_t end, const UpdateOptions &options, arma::mat &xx, arma::mat &xy, arma::vec &yy );
         
         // Data
         Grid *mGrid;
         Field *mFields;
         std::string mName;
         std::vector< Site* > mSites; 
-        std::vector< PermSite* > mPermSites; 
+        std::vector< PermMultipole > mPermMultipoles; 
         std::unordered_map< std::string, Site* > mNameToSite;
         
         arma::vec mPermField;
@@ -177,6 +246,14 @@ namespace FieldFit
         // OnUpdate generated
         arma::mat mX_prime_x;
         arma::mat mX_prime_y;
+        arma::vec mY_prime_y;
+        
+        size_t mReleasedBytes;
+        
+        bool mMixedPrecision;
+        
+        std::unique_ptr< const PermTree > mPermTree;
+        F64 mPermTreeError;
     };
 }
 
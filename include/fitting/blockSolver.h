@@ -0,0 +1,95 @@
+#pragma once
+#ifndef __BLOCKSOLVER_H__
+#define __BLOCKSOLVER_H__
+
+#include "common/types.h"
+
+#include <vector>
+#include <cstddef>
+#include <armadillo>
+
+namespace FieldFit
+{
+    class ThreadPool;
+
+    /*
+    **  Solves the bordered normal equations of the fit without assembling them, when X'X is block diagonal:
+    **
+    **      | A  C' | | x |   | b |
+    **      | C  0  | | l | = | d |
+    **
+    **  Every block of A is factored on its own, in parallel, and only the constraints C couple them through
+    **  the Schur complement S = C A^-1 C'. The cost grows linearly with the number of blocks, plus that of S
+    **  for the constraints that span several blocks.
+    **
+    **  Neighbouring blocks with the same matrix, like the collections of a system, share a single factorization.
+    **  Their right hand sides and constraint columns are then solved together, as the columns of one matrix.
+    */
+    class BlockSolver
+    {
+    public:
+
+        // the blocks lie on the diagonal one after the other, constraints has a row per constraint and a column per parameter
+        BlockSolver( std::vector< arma::mat > &&blocks, const arma::sp_mat &constraints, ThreadPool &pool );
+
+        // false when a block or the Schur complement is not positive definite, a dense solve is needed then
+        bool Factor();
+
+        // for rhs = [ b; d ], laid out like the dense bordered system
+        arma::vec Solve( const arma::vec &rhs ) const;
+
+        // the bordered matrix times [ x; l ], for residuals
+        arma::vec Multiply( const arma::vec &solution ) const;
+
+        size_t NumBlocks() const;
+        size_t NumFactorizations() const;
+
+    private:
+
+        struct Block
+        {
+            size_t first;
+
+            // the constraints that touch the block, their coefficients in it and A^-1 C'
+            arma::uvec constraints;
+            arma::mat coupling;
+            arma::mat weights;
+        };
+
+        struct Group
+        {
+            arma::mat matrix;
+
+            // upper cholesky factor of matrix
+            arma::mat factor;
+
+            // the blocks [begin, end) share the matrix
+            size_t begin, end;
+        };
+
+        // runs function( g ) for every group index, spread over the pool
+        template< class Function >
+        void ForEachGroup( Function function ) const;
+
+        // the solve with the factors only, Solve corrects it
+        arma::vec SolveFactored( const arma::vec &rhs ) const;
+        arma::mat SolveGroup( const Group &group, const arma::mat &rhs ) const;
+
+        // the parts of a vector that belong to the blocks of a group, side by side
+        arma::mat GatherColumns( const Group &group, const arma::vec &vector ) const;
+        void ScatterColumns( const Group &group, const arma::mat &columns, arma::vec &vector ) const;
+
+        std::vector< Block > mBlocks;
+        std::vector< Group > mGroups;
+        arma::sp_mat mConstraints;
+
+        // upper cholesky factor of the Schur complement
+        arma::mat mSchurFactor;
+
+        size_t mNumColumns;
+
+        ThreadPool &mPool;
+    };
+}
+
+#endif
@@ -6,13 +6,50 @@
 
 #include "configuration/fitType.h"
 
+#include "fitting/permMultipole.h"
+
+#include <string>
 #include <armadillo>
 
 namespace FieldFit
 {
+    // the instruction sets the grid kernels are built for, from narrow to wide
+    enum KernelIsa
+    {
+        scalar = 0,
+        sse2   = 1,
+        avx2   = 2,
+        avx512 = 3
+    };
+    
+    // the widest instruction set that is supported by the cpu, which is used unless SetKernelIsa overrides it
+    KernelIsa DetectKernelIsa();
+    KernelIsa GetKernelIsa();
+    void SetKernelIsa( KernelIsa isa );
+    
+    KernelIsa StringToKernelIsa( const std::string &isa );
+    std::string EnumToString( KernelIsa isa );
+    
     arma::vec DelComp( const F64 posX, const F64 posY, const F64 posZ,
                        const arma::vec &gridX, const arma::vec &gridY,  const arma::vec &gridZ,
                        const FitType type );
+    
+    /*
+    **  Computes the columns of all fit types of a single site in one pass over the grid, where
+    **  columns[t] receives the values of FitType t, or is nullptr when the type is not fitted.
+    **  Per point 1/r, 1/r^3 and 1/r^5 are computed once and shared by all types. With mixedPrecision
+    **  they are evaluated in F32, with twice the lanes, and the columns are widened to F64.
+    */
+    void DelCompSite( const F64 posX, const F64 posY, const F64 posZ,
+                      const F64 *gridX, const F64 *gridY, const F64 *gridZ, const size_t numPoints,
+                      F64 *const columns[ FitType::size ], const bool mixedPrecision = false );
+    
+    // adds the potential of all multipoles to field, in one pass over tiles of the grid
+    void DelCompPermField( const PermMultipole *multipoles, const size_t numMultipoles,
+                           const F64 *gridX, const F64 *gridY, const F64 *gridZ, const size_t numPoints, F64 *field );
+    
+    // the sum of ( observed - perm - model )^2
+    F64 SquaredResiduals( const F64 *observed, const F64 *perm, const F64 *model, const size_t numPoints );
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,292 @@
+#pragma once
+#ifndef __DELCOMPKERNELS_H__
+#define __DELCOMPKERNELS_H__
+
+#include "common/types.h"
+
+#include "configuration/fitType.h"
+
+#include "fitting/permMultipole.h"
+
+#include <cstddef>
+
+/*
+**  The grid kernels behind DelCompSite, DelCompPermField and SquaredResiduals, written once against
+**  a Lanes type that provides the vector operations of an instruction set:
+**
+**      typedef ... Vec;  static const size_t width;
+**      Set1, Load, Store, Add, Sub, Mul, Div, Sqrt
+**
+**  Every instruction set runs the same operations in the same order and does not contract them into
+**  fused multiply adds, so the columns agree bit for bit between instruction sets. The residuals are
+**  always summed in gResidualLanes interleaved partial sums, so their total does too.
+**
+**  The F32 lanes of an instruction set hold twice as many values and convert in Load and Store, so
+**  the same kernels evaluate the columns in single precision while reading and writing F64.
+**
+**  This header is included by translation units that are compiled for a specific instruction set,
+**  so it must not pull in inline functions of other headers that the linker could merge.
+*/
+namespace FieldFit
+{
+    namespace DelCompKernels
+    {
+        const size_t gResidualLanes = 8;
+
+        // these process [begin, end) in whole vectors and return where they stopped
+        typedef size_t ( *SiteKernel )( const F64 posX, const F64 posY, const F64 posZ,
+                                        const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t begin, size_t end,
+                                        F64 *const columns[ FitType::size ] );
+
+        typedef size_t ( *PermFieldKernel )( const PermMultipole *multipoles, size_t numMultipoles,
+                                             const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t begin, size_t end,
+                                             F64 *field );
+
+        typedef size_t ( *ResidualKernel )( const F64 *observed, const F64 *perm, const F64 *model, size_t begin, size_t end,
+                                            F64 partial[ gResidualLanes ] );
+
+        struct Table
+        {
+            SiteKernel site;
+            SiteKernel site32;
+            PermFieldKernel permField;
+            ResidualKernel residuals;
+        };
+
+        // defined by the translation units compiled for these instruction sets
+        extern const Table gAvx2;
+        extern const Table gAvx512;
+
+        template< class Lanes >
+        struct Point
+        {
+            typedef typename Lanes::Vec Vec;
+
+            Point( const Vec &px, const Vec &py, const Vec &pz, const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t i ) :
+                dx( Lanes::Sub( Lanes::Load( gridX + i ), px ) ),
+                dy( Lanes::Sub( Lanes::Load( gridY + i ), py ) ),
+                dz( Lanes::Sub( Lanes::Load( gridZ + i ), pz ) ),
+                xx( Lanes::Mul( dx, dx ) ), yy( Lanes::Mul( dy, dy ) ), zz( Lanes::Mul( dz, dz ) ),
+                invR( Lanes::Div( Lanes::Set1( 1.0 ), Lanes::Sqrt( Lanes::Add( Lanes::Add( xx, yy ), zz ) ) ) ),
+                invR2( Lanes::Mul( invR, invR ) ),
+                invR3( Lanes::Mul( invR2, invR ) ),
+                invR5( Lanes::Mul( invR3, invR2 ) )
+            {
+            }
+
+            // the contribution of a unit multipole of the given type
+            Vec Column( const FitType type ) const
+            {
+                const Vec sqrt3 = Lanes::Set1( 1.73205081 );
+
+                switch ( type )
+                {
+                case FitType::charge:
+                    return invR;
+                case FitType::dipoleX:
+                    return Lanes::Mul( dx, invR3 );
+                case FitType::dipoleY:
+                    return Lanes::Mul( dy, invR3 );
+                case FitType::dipoleZ:
+                    return Lanes::Mul( dz, invR3 );
+                case FitType::qd20:
+                    return Lanes::Mul( Lanes::Sub( zz, Lanes::Mul( Lanes::Add( xx, yy ), Lanes::Set1( 0.5 ) ) ), invR5 );
+                case FitType::qd21c:
+                    return Lanes::Mul( Lanes::Mul( Lanes::Mul( dx, dz ), sqrt3 ), invR5 );
+                case FitType::qd21s:
+                    return Lanes::Mul( Lanes::Mul( Lanes::Mul( dy, dz ), sqrt3 ), invR5 );
+                case FitType::qd22c:
+                    return Lanes::Mul( Lanes::Mul( Lanes::Sub( xx, yy ), Lanes::Set1( 0.5 * 1.73205081 ) ), invR5 );
+                case FitType::qd22s:
+                default:
+                    return Lanes::Mul( Lanes::Mul( Lanes::Mul( dx, dy ), sqrt3 ), invR5 );
+                }
+            }
+
+            Vec dx, dy, dz;
+            Vec xx, yy, zz;
+            Vec invR, invR2, invR3, invR5;
+        };
+
+        // the fit type masks StringTypeToFitFlags produces, the alpha flags reuse the dipole masks
+        const U32 gCharge  = 1 << FitType::charge;
+        const U32 gDipoleX = 1 << FitType::dipoleX;
+        const U32 gDipoleY = 1 << FitType::dipoleY;
+        const U32 gDipoleZ = 1 << FitType::dipoleZ;
+        const U32 gDipole  = gDipoleX | gDipoleY | gDipoleZ;
+        const U32 gQpol    = ( 1 << FitType::qd20 ) | ( 1 << FitType::qd21c ) | ( 1 << FitType::qd21s ) |
+                             ( 1 << FitType::qd22c ) | ( 1 << FitType::qd22s );
+
+        // a site with a fixed set of columns, the type tests and unused powers of r fold away at compile time
+        template< class Lanes, U32 Mask >
+        size_t SiteOf( const F64 posX, const F64 posY, const F64 posZ,
+                       const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t begin, size_t end,
+                       F64 *const columns[ FitType::size ] )
+        {
+            const typename Lanes::Vec px = Lanes::Set1( posX ), py = Lanes::Set1( posY ), pz = Lanes::Set1( posZ );
+
+            size_t i = begin;
+
+            for ( ; i + Lanes::width <= end; i += Lanes::width )
+            {
+                const Point< Lanes > point( px, py, pz, gridX, gridY, gridZ, i );
+
+                for ( S32 t=0; t < FitType::size; ++t )
+                {
+                    if ( Mask & ( 1 << t ) )
+                    {
+                        Lanes::Store( columns[t] + i, point.Column( ( FitType ) t ) );
+                    }
+                }
+            }
+
+            return i;
+        }
+
+        // any other combination of columns, tested per point
+        template< class Lanes >
+        size_t SiteAny( const F64 posX, const F64 posY, const F64 posZ,
+                        const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t begin, size_t end,
+                        F64 *const columns[ FitType::size ] )
+        {
+            const typename Lanes::Vec px = Lanes::Set1( posX ), py = Lanes::Set1( posY ), pz = Lanes::Set1( posZ );
+
+            size_t i = begin;
+
+            for ( ; i + Lanes::width <= end; i += Lanes::width )
+            {
+                const Point< Lanes > point( px, py, pz, gridX, gridY, gridZ, i );
+
+                for ( S32 t=0; t < FitType::size; ++t )
+                {
+                    if ( columns[t] )
+                    {
+                        Lanes::Store( columns[t] + i, point.Column( ( FitType ) t ) );
+                    }
+                }
+            }
+
+            return i;
+        }
+
+        // picks the kernel once per site
+        template< class Lanes >
+        size_t Site( const F64 posX, const F64 posY, const F64 posZ,
+                     const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t begin, size_t end,
+                     F64 *const columns[ FitType::size ] )
+        {
+            U32 mask = 0;
+
+            for ( S32 t=0; t < FitType::size; ++t )
+            {
+                mask |= columns[t] ? 1 << t : 0;
+            }
+
+            switch ( mask )
+            {
+            case gCharge:
+                return SiteOf< Lanes, gCharge >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gDipoleX:
+                return SiteOf< Lanes, gDipoleX >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gDipoleY:
+                return SiteOf< Lanes, gDipoleY >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gDipoleZ:
+                return SiteOf< Lanes, gDipoleZ >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gDipoleX | gDipoleY:
+                return SiteOf< Lanes, gDipoleX | gDipoleY >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gDipoleX | gDipoleZ:
+                return SiteOf< Lanes, gDipoleX | gDipoleZ >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gDipoleY | gDipoleZ:
+                return SiteOf< Lanes, gDipoleY | gDipoleZ >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gDipole:
+                return SiteOf< Lanes, gDipole >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gQpol:
+                return SiteOf< Lanes, gQpol >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gCharge | gDipole:
+                return SiteOf< Lanes, gCharge | gDipole >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            case gCharge | gDipole | gQpol:
+                return SiteOf< Lanes, gCharge | gDipole | gQpol >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            default:
+                return SiteAny< Lanes >( posX, posY, posZ, gridX, gridY, gridZ, begin, end, columns );
+            }
+        }
+
+        // the multipoles are summed in order for each point, the point stays in registers meanwhile
+        template< class Lanes >
+        size_t PermField( const PermMultipole *multipoles, size_t numMultipoles,
+                          const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t begin, size_t end,
+                          F64 *field )
+        {
+            typedef typename Lanes::Vec Vec;
+
+            const Vec one = Lanes::Set1( 1.0 );
+
+            size_t i = begin;
+
+            for ( ; i + Lanes::width <= end; i += Lanes::width )
+            {
+                const Vec gx = Lanes::Load( gridX + i ), gy = Lanes::Load( gridY + i ), gz = Lanes::Load( gridZ + i );
+
+                Vec sum = Lanes::Load( field + i );
+
+                for ( const PermMultipole *m = multipoles, *mEnd = multipoles + numMultipoles; m != mEnd; ++m )
+                {
+                    const Vec dx = Lanes::Sub( gx, Lanes::Set1( m->x ) );
+                    const Vec dy = Lanes::Sub( gy, Lanes::Set1( m->y ) );
+                    const Vec dz = Lanes::Sub( gz, Lanes::Set1( m->z ) );
+
+                    const Vec r2 = Lanes::Add( Lanes::Add( Lanes::Mul( dx, dx ), Lanes::Mul( dy, dy ) ), Lanes::Mul( dz, dz ) );
+                    const Vec invR = Lanes::Div( one, Lanes::Sqrt( r2 ) );
+                    const Vec invR3 = Lanes::Mul( Lanes::Mul( invR, invR ), invR );
+
+                    // q / r + ( mu . d ) / r^3
+                    const Vec dot = Lanes::Add( Lanes::Add( Lanes::Mul( dx, Lanes::Set1( m->dipoleX ) ), Lanes::Mul( dy, Lanes::Set1( m->dipoleY ) ) ),
+                                                Lanes::Mul( dz, Lanes::Set1( m->dipoleZ ) ) );
+
+                    sum = Lanes::Add( sum, Lanes::Add( Lanes::Mul( Lanes::Set1( m->charge ), invR ), Lanes::Mul( dot, invR3 ) ) );
+                }
+
+                Lanes::Store( field + i, sum );
+            }
+
+            return i;
+        }
+
+        template< class Lanes >
+        size_t Residuals( const F64 *observed, const F64 *perm, const F64 *model, size_t begin, size_t end,
+                          F64 partial[ gResidualLanes ] )
+        {
+            const size_t numVecs = gResidualLanes / Lanes::width;
+
+            typename Lanes::Vec sums[ gResidualLanes / Lanes::width ];
+
+            for ( size_t v=0; v < numVecs; ++v )
+            {
+                sums[v] = Lanes::Load( partial + v * Lanes::width );
+            }
+
+            size_t i = begin;
+
+            for ( ; i + gResidualLanes <= end; i += gResidualLanes )
+            {
+                for ( size_t v=0; v < numVecs; ++v )
+                {
+                    const size_t j = i + v * Lanes::width;
+
+                    const typename Lanes::Vec diff = Lanes::Sub( Lanes::Sub( Lanes::Load( observed + j ), Lanes::Load( perm + j ) ), Lanes::Load( model + j ) );
+
+                    sums[v] = Lanes::Add( sums[v], Lanes::Mul( diff, diff ) );
+                }
+            }
+
+            for ( size_t v=0; v < numVecs; ++v )
+            {
+                Lanes::Store( partial + v * Lanes::width, sums[v] );
+            }
+
+            return i;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+#ifndef __FACTORIZATION_H__
+#define __FACTORIZATION_H__
+
+#include "common/types.h"
+
+#include <memory>
+#include <vector>
+#include <armadillo>
+
+namespace FieldFit
+{
+    /*
+    **  LU factorization of the bordered normal equations, computed once and then used for every solve
+    **  against the same matrix, like the corrections of Fitter::Refine. The constraint border makes the
+    **  matrix indefinite, so there is no cholesky factor.
+    */
+    class DenseFactorization
+    {
+    public:
+
+        // false when the matrix is singular
+        bool Factor( const arma::mat &matrix );
+
+        arma::vec Solve( const arma::vec &rhs ) const;
+
+    private:
+
+        // L below the diagonal and U on and above it, as LAPACK leaves them
+        arma::mat mFactors;
+        std::vector< arma::blas_int > mPivots;
+    };
+
+#ifdef FIELDFIT_USE_SPARSE
+
+    /*
+    **  Like DenseFactorization, but the sparse LU factors of SuperLU, with the column ordering spsolve uses.
+    */
+    class SparseFactorization
+    {
+    public:
+
+        SparseFactorization();
+        ~SparseFactorization();
+
+        SparseFactorization( const SparseFactorization & ) = delete;
+        SparseFactorization &operator=( const SparseFactorization & ) = delete;
+
+        bool Factor( const arma::sp_mat &matrix );
+
+        arma::vec Solve( const arma::vec &rhs ) const;
+
+    private:
+
+        // keeps the SuperLU types out of the header
+        struct Factors;
+
+        std::unique_ptr< Factors > mFactors;
+    };
+
+#endif
+}
+
+#endif
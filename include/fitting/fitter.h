@@ -6,10 +6,11 @@
 
 #include "configuration/fitType.h"
 #include "fitting/fitting_math.h"
-
+#include "fitting/blockSolver.h"
 
 #include <string>
 #include <vector>
+#include <memory>
 #include <armadillo>
 
 namespace FieldFit
@@ -18,6 +19,7 @@ namespace FieldFit
     class System;
     class Console;
     class Constraints;
+    class ThreadPool;
     class Configuration;
     class PrototypeConstraint;
     
@@ -49,7 +51,7 @@ namespace FieldFit
         	std::vector< F64 > coefficients;
         };
     
-        void Fit( Console &console, const Configuration &config, const Constraints &constr, bool verbose );
+        void Fit( Console &console, const Configuration &config, const Constraints &constr, ThreadPool &pool, bool verbose );
         
     private:
         
@@ -62,12 +64,40 @@ namespace FieldFit
         void AddConfiguration( Console &console, const Configuration &config );
         void AddConstraints( Console &console, const Constraints &constr );
         
+        // places the X'X of every local system on the diagonal of x_prime_x, then adds the restraints and borders it with the constraints,
+        // all in a matrix that is sized up front
+        void AddMatrix( Console &console );
+        
+        // the structured alternative to AddMatrix, false when a restraint couples local systems or a block is singular
+        bool AddBlockSolver( Console &console, ThreadPool &pool );
+        
+        // the local system that holds a column
+        size_t FindLocalSystem( size_t column ) const;
+        
+        // the local systems [first, SystemEnd( first ) ) all belong to the system of first
+        size_t SystemEnd( size_t first ) const;
+        
+        // the solution of the local systems [first, last) of a single system, a column per collection of its field
+        arma::mat SystemCoefficients( size_t first, size_t last ) const;
+        
+        // with the block solver, the factored bordered system or a plain solve, whichever is in use
+        arma::vec Solve( const arma::vec &rhs ) const;
+        arma::vec Multiply( const arma::vec &solution ) const;
+        
+        // iterative refinement against the F64 normal equations of the systems, for mixed precision
+        void Refine( Console &console, F64 tolerance );
+        
         void WriteSolution( Console &console );
         
         fit_matrix x_prime_x;
         arma::vec  x_prime_y;
         arma::vec  mSolution;
         
+        std::unique_ptr< BlockSolver > mBlockSolver;
+        
+        // the factors of x_prime_x when it is solved repeatedly, for refinement
+        std::unique_ptr< fit_factorization > mFactorization;
+        
         std::vector< LocalSystem > mLocalSystems;
         std::vector< InternalConstraint > mInternalConstraints;
         std::vector< InternalConstraint > mInternalRestraints;
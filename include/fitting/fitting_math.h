@@ -2,16 +2,23 @@
 #ifndef __FITTING_MATH_H__
 #define __FITTING_MATH_H__
 
+#include "fitting/factorization.h"
+#include "fitting/matrixAssembly.h"
+
 #include <armadillo>
 
 #ifndef FIELDFIT_USE_SPARSE
 
 typedef arma::mat fit_matrix;
+typedef FieldFit::DenseAssembly fit_assembly;
+typedef FieldFit::DenseFactorization fit_factorization;
 #define FIELDFIT_SOLVE solve
 
 #else
 
 typedef arma::sp_mat fit_matrix;
+typedef FieldFit::SparseAssembly fit_assembly;
+typedef FieldFit::SparseFactorization fit_factorization;
 #define FIELDFIT_SOLVE spsolve
 
 #endif
@@ -0,0 +1,68 @@
+#pragma once
+#ifndef __MATRIXASSEMBLY_H__
+#define __MATRIXASSEMBLY_H__
+
+#include "common/types.h"
+
+#include <vector>
+#include <cstddef>
+#include <armadillo>
+
+namespace FieldFit
+{
+    /*
+    **  Builds the size x size bordered normal equations from blocks on the diagonal and single entries,
+    **  the restraints and constraints, which are added to what is there already. Every entry is written
+    **  directly into the dense matrix, that is zeroed once up front.
+    */
+    class DenseAssembly
+    {
+    public:
+
+        DenseAssembly( arma::mat &matrix, size_t size, size_t nonZeros );
+
+        // the memory of the finished matrix
+        static size_t Bytes( size_t size, size_t nonZeros );
+
+        // a square block whose first row and column are first
+        void AddBlock( size_t first, const arma::mat &block );
+        void Add( size_t row, size_t col, F64 value );
+
+        void Finish();
+
+    private:
+
+        arma::mat &mMatrix;
+    };
+
+    /*
+    **  Like DenseAssembly, but for a sparse matrix. Every insertion into compressed columns moves all
+    **  entries after it, so the entries are collected as ( row, col, value ) triplets instead and the
+    **  matrix is built from them at once in Finish, summing the duplicates.
+    */
+    class SparseAssembly
+    {
+    public:
+
+        // nonZeros is the number of triplets to reserve for
+        SparseAssembly( arma::sp_mat &matrix, size_t size, size_t nonZeros );
+
+        static size_t Bytes( size_t size, size_t nonZeros );
+
+        void AddBlock( size_t first, const arma::mat &block );
+        void Add( size_t row, size_t col, F64 value );
+
+        void Finish();
+
+    private:
+
+        arma::sp_mat &mMatrix;
+        size_t mSize;
+
+        std::vector< arma::uword > mRows;
+        std::vector< arma::uword > mCols;
+        std::vector< F64 > mValues;
+    };
+}
+
+#endif
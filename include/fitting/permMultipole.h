@@ -0,0 +1,21 @@
+#pragma once
+#ifndef __PERMMULTIPOLE_H__
+#define __PERMMULTIPOLE_H__
+
+#include "common/types.h"
+
+namespace FieldFit
+{
+    /*
+    **  A permanent (not fitted) site of a system, a point charge, a point dipole or both. The
+    **  records are stored contiguously and read directly by the permanent field kernel.
+    */
+    struct PermMultipole
+    {
+        F64 x, y, z;
+        F64 charge;
+        F64 dipoleX, dipoleY, dipoleZ;
+    };
+}
+
+#endif
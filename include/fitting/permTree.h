@@ -0,0 +1,67 @@
+#pragma once
+#ifndef __PERMTREE_H__
+#define __PERMTREE_H__
+
+#include "common/types.h"
+
+#include "fitting/permMultipole.h"
+
+#include <vector>
+#include <cstddef>
+
+namespace FieldFit
+{
+    /*
+    **  Octree over the permanent multipoles of a system, for an approximate permanent field. Every node
+    **  holds the charge, dipole and quadrupole of its multipoles about its centre. The grid points are
+    **  evaluated in batches of neighbours along a Morton curve; a node is expanded for a whole batch when
+    **
+    **      ( node radius + batch radius ) < theta * distance between their centres
+    **
+    **  otherwise its children are tried, and the multipoles of a leaf are summed directly. A theta close
+    **  to 0 approaches direct summation, the error grows with roughly the third power of theta.
+    */
+    class PermTree
+    {
+    public:
+
+        PermTree( const std::vector< PermMultipole > &multipoles, F64 theta );
+
+        // adds the field of the multipoles to field, like DelCompPermField
+        void Evaluate( const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t numPoints, F64 *field ) const;
+
+        F64 GetTheta() const;
+
+    private:
+
+        struct Node
+        {
+            F64 centre[3];
+            F64 radius;
+
+            // about the centre, the quadrupole is traceless: xx, yy, zz, xy, xz, yz
+            F64 charge;
+            F64 dipole[3];
+            F64 quadrupole[6];
+
+            // the multipoles [begin, end) and children [firstChild, firstChild + numChildren)
+            size_t begin, end;
+            size_t firstChild, numChildren;
+        };
+
+        void Split( size_t node, F64 halfWidth, U32 depth );
+
+        void SetMoments( Node &node ) const;
+
+        void EvaluateBatch( const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t numPoints, F64 *field,
+                            std::vector< size_t > &stack ) const;
+
+        // sorted so that every node covers a contiguous range
+        std::vector< PermMultipole > mMultipoles;
+        std::vector< Node > mNodes;
+
+        F64 mTheta;
+    };
+}
+
+#endif
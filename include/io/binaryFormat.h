@@ -0,0 +1,64 @@
+#pragma once
+#ifndef __BINARYFORMAT_H__
+#define __BINARYFORMAT_H__
+
+#include "common/types.h"
+
+#include <cstring>
+
+namespace FieldFit
+{
+    /*
+    **  Layout of the binary container written by --convert
+    **
+    **  [ Header ][ Record ][ tokens ][ pad ][ payload ][ pad ][ Record ] ...
+    **
+    **  Every record and every payload starts on a 64 byte boundary, so that a mapped payload can be
+    **  handed to armadillo as is. Tokens are stored as a U32 length followed by the characters and hold
+    **  the non numeric part of a block ( system name, sizes, site names and flags ). The payload is a
+    **  column major F64 matrix that is already converted to internal units ( bohr, e, e/bohr, e/bohr^2 ).
+    **  All numbers are in native byte order, the byte order marker guards against foreign files.
+    */
+    namespace BinaryFormat
+    {
+        const char Magic[8] = { 'F', 'F', 'B', 'I', 'N', 'A', 'R', 'Y' };
+        const U32 Version   = 1;
+        const U32 ByteOrder = 0x01020304;
+        const U64 Alignment = 64;
+
+        struct Header
+        {
+            char magic[8];
+            U32 version;
+            U32 byteOrder;
+            U64 numRecords;
+            U64 reserved[5];
+        };
+
+        struct Record
+        {
+            char title[16];
+            U64 numTokens;
+            U64 rows;
+            U64 cols;
+            U64 payloadOffset;
+            U64 nextOffset;
+            U64 reserved;
+        };
+
+        static_assert( sizeof( Header ) == Alignment, "binary header should fill exactly one alignment unit" );
+        static_assert( sizeof( Record ) == Alignment, "binary record should fill exactly one alignment unit" );
+
+        inline U64 Align( U64 offset )
+        {
+            return ( offset + Alignment - 1 ) & ~( Alignment - 1 );
+        }
+
+        inline bool IsBinary( const char *data, size_t size )
+        {
+            return size >= sizeof( Header ) && memcmp( data, Magic, sizeof( Magic ) ) == 0;
+        }
+    }
+}
+
+#endif
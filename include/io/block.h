@@ -3,11 +3,15 @@
 
 #include <vector>
 #include <string>
+#include <memory>
 #include <assert.h>
 #include <iostream>
 
 #include "common/types.h"
 #include "common/util.h"
+#include "common/exception.h"
+
+#include "io/numberParser.h"
 
 namespace FieldFit
 {
@@ -18,48 +22,78 @@ namespace FieldFit
     {
     public:
     
+    	/*
+    	**	A non-owning view on a single token, the characters live in the source buffer of the block
+    	*/
     	class Token
     	{
     	public:
     		
-    		Token( const std::string &token) : mToken( token )
+    		Token( const char *begin, size_t length ) : mBegin( begin ), mLength( length )
     		{
     		}
     		
-    		Token& operator=(Token const &rhs) {
-    			
-    			mToken = rhs.GetToken();
-    			
-    			return *this;
-    		};
+    		template< class T >
+    		bool TryValue( T &value ) const
+    		{
+    			return NumberParser::Parse( mBegin, mBegin + mLength, value );
+    		}
     		
     		template< class T >
     		T GetValue() const
     		{
-    			return Util::FromString< T >( mToken );
+    			T value;
+    			
+    			if ( !TryValue( value ) )
+    			{
+    				throw ArgException( "Block", "Token::GetValue", "malformed numeric value '"+GetToken()+"'" );
+    			}
+    			
+    			return value;
+    		}
+    		
+    		std::string GetToken() const
+    		{
+    			return std::string( mBegin, mLength );	
+    		}
+    		
+    		const char *Data() const
+    		{
+    			return mBegin;
     		}
     		
-    		const std::string & GetToken() const
+    		size_t Length() const
     		{
-    			return mToken;	
+    			return mLength;
     		}
     		
-    		bool Equals( const std::string &comp )
+    		bool Equals( const std::string &comp ) const
     		{
-    			return 	comp.compare( mToken ) == 0 ? true : false;
+    			return 	comp.compare( 0, std::string::npos, mBegin, mLength ) == 0 ? true : false;
     		}
     		
-    		void Debug()
+    		void Debug() const
     		{
-    			std::cout << "\t" << mToken << std::endl;
+    			std::cout << "\t";
+    			std::cout.write( mBegin, mLength ) << std::endl;
     		}
     		
     	private:
     		
-    		std::string mToken;	
+    		const char *mBegin;
+    		size_t mLength;
     	};
     	
-    	Block( const std::string & title, const std::vector< std::string > &buffer );
+    	Block( const std::string & title, std::vector< Token > &&buffer, const std::shared_ptr< const void > &source );
+    	
+    	// only the header is tokenized, the rest of the block is scanned by its reader ( see TokenStream ),
+    	// file is the name of the file the block was read from
+    	Block( const std::string & title, std::vector< Token > &&buffer, const std::shared_ptr< const void > &source,
+    	       const char *bodyBegin, const char *bodyEnd, const std::string &file );
+    	
+    	// block from a binary container, the numeric data is a column major matrix in internal units
+    	Block( const std::string & title, std::vector< Token > &&buffer, const std::shared_ptr< const void > &source,
+    	       const F64 *payload, size_t rows, size_t cols );
     	
     	size_t Size() const; 
     	
@@ -69,14 +103,58 @@ namespace FieldFit
     	
     	const Token* GetToken( U32 index ) const;
     	
+    	// Numeric value of a token, a malformed value is reported with its position in the block
+    	template< class T >
+    	T GetValue( U32 index ) const;
+    	
     	std::vector< Token >::const_iterator Begin() const;
     	std::vector< Token >::const_iterator End() const;
     	
+    	const char *BodyBegin() const;
+    	const char *BodyEnd() const;
+    	
+    	bool HasPayload() const;
+    	
+    	const F64 *GetPayload() const;
+    	size_t PayloadRows() const;
+    	size_t PayloadCols() const;
+    	
+    	const std::shared_ptr< const void > &GetSource() const;
+    	
+    	// the file the block was read from, empty when it is not known
+    	const std::string &GetFile() const;
+    	
     private:
     	
     	const std::string mTitle;
     	std::vector< Token > mTokens;
+    	
+    	// keeps the buffer the tokens point into alive
+    	std::shared_ptr< const void > mSource;
+    	
+    	const char *mBodyBegin;
+    	const char *mBodyEnd;
+    	std::string mFile;
+    	
+    	const F64 *mPayload;
+    	size_t mRows;
+    	size_t mCols;
     };
+    
+    template< class T >
+    T Block::GetValue( U32 index ) const
+    {
+    	const Token *token = GetToken( index );
+    	
+    	T value;
+    	
+    	if ( !token->TryValue( value ) )
+    	{
+    		throw ArgException( "Block", "GetValue", "block ["+mTitle+"] token "+Util::ToString( index )+" has malformed numeric value '"+token->GetToken()+"'" );
+    	}
+    	
+    	return value;
+    }
 }
 
 #endif
\ No newline at end of file
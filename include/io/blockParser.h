@@ -6,14 +6,24 @@
 
 #include <string>
 #include <map>
+#include <deque>
+#include <mutex>
+#include <future>
+#include <memory>
 #include <vector>
+#include <exception>
+#include <condition_variable>
 
 namespace FieldFit
 {
     class Block;
+    class MappedFile;
+    class ThreadPool;
     
     /*
-    **	Class to parse the blocks within a series of files
+    **	Class to parse the blocks within a series of files, both text and binary ( see binaryFormat.h )
+    **	files can be mixed in the same run. Parsing only indexes where each block lies, a block is tokenized
+    **	when it is requested and released as soon as the caller is done with it.
     */
     class BlockParser
     {
@@ -21,18 +31,97 @@ namespace FieldFit
     	
     	BlockParser( const std::vector< std::string >  &files  );	
     	
-    	const std::vector< Block > * GetBlockArray( const std::string &block ) const;
+    	/*
+    	**	The files are indexed concurrently, a few ahead of the last merged one, but only become visible
+    	**	once merged by MergeNext or MergeAll. The blocks are still ordered as if indexed one after the
+    	**	other, so readers can start on the first files, or the first blocks of a stream, while later
+    	**	ones are indexed.
+    	*/
+    	BlockParser( const std::vector< std::string >  &files, ThreadPool &pool );
     	
-        const Block * GetBlock( const std::string &block ) const;
+    	// adds the blocks indexed since the last call, of the first file in input order that is not complete,
+    	// waiting for at least one of them or the end of that file; false once every file was merged
+    	bool MergeNext();
+    	void MergeAll();
+    	
+    	// while a file is only partly merged, the first token of its last merged block, e.g. the system its
+    	// later blocks may still belong to; empty otherwise
+    	const std::string &GetPartialFirstToken() const;
+    	
+    	size_t NumBlocks( const std::string &block ) const;
+    	
+    	// tokenizes the index-th block of the requested type
+    	Block GetBlock( const std::string &block, size_t index ) const;
+    	
+        std::unique_ptr< const Block > GetBlock( const std::string &block ) const;
+        
+        // the first token of a block, e.g. the system it belongs to, without tokenizing the rest
+        std::string GetFirstToken( const std::string &block, size_t index ) const;
+        
+        // drops the text of a block that has been read from memory, it stays accessible for files on disk
+        void Release( const std::string &block, size_t index ) const;
          
+        // also drops the already read text of the blocks from memory
         void DeleteBlock( const std::string &block );
 
         void Clear(); 
+        
+        // wall time in seconds spent on each merged file, in input order
+        const std::vector< std::pair< std::string, F64 > > &GetParseTimes() const;
          
     private:	
     	
-    	void ParseFile( const std::string &file );
-        std::map< std::string, std::vector< Block > > mBlocks;
+    	// a text block spans the lines [ begin, end ) after its title, a binary block starts at its record
+    	struct Entry
+    	{
+    		std::shared_ptr< const MappedFile > file;
+    		const char *begin;
+    		const char *end;
+    		bool binary;
+    	};
+    	
+    	typedef std::map< std::string, std::vector< Entry > > IndexMap;
+    	
+    	// a file that is being indexed, its blocks are handed over as soon as they are closed
+    	struct Indexing
+    	{
+    		std::mutex mutex;
+    		std::condition_variable condition;
+    		
+    		// the blocks that were not merged yet
+    		IndexMap index;
+    		
+    		bool done;
+    		F64 seconds;
+    		std::exception_ptr error;
+    	};
+    	
+    	// keeps the files after the merged ones indexing on the pool
+    	void IndexAhead();
+    	void Merge( IndexMap &index );
+    	
+    	static void IndexFile( const std::string &file, Indexing &indexing );
+    	static void IndexBinaryFile( const std::shared_ptr< const MappedFile > &mapped, Indexing &indexing );
+    	static void Publish( Indexing &indexing, const std::string &title, const Entry &entry );
+    	
+    	static std::string FirstToken( const std::string &title, const Entry &entry );
+    	
+    	static Block ParseBlock( const std::string &title, const Entry &entry );
+    	static Block ParseBinaryBlock( const std::string &title, const Entry &entry );
+    	
+    	const Entry &GetEntry( const std::string &block, size_t index ) const;
+    	
+        IndexMap mIndex;
+        std::vector< std::pair< std::string, F64 > > mParseTimes;
+        
+        std::vector< std::string > mFiles;
+        ThreadPool *mPool;
+        
+        // the files after the merged ones, with the task that indexes them, its own thread when the pool has no workers
+        std::deque< std::pair< std::shared_ptr< Indexing >, std::future< void > > > mIndexing;
+        size_t mNumMerged;
+        
+        std::string mPartialFirstToken;
     };
 
 }
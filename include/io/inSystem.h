@@ -10,24 +10,35 @@
 namespace FieldFit
 {
     class Block;
+    class ThreadPool;
     class System;
     class BlockParser;
     class Configuration;
     
     Units* ReadUnits( BlockParser & );
     
-    void ReadGrids( BlockParser &, const Units &units, Configuration &config );
-    void ReadFields( BlockParser &, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection );
-    void ReadEfields( BlockParser &, const Units &units, Configuration &config );
+    void ReadGrids( BlockParser &, const Units &units, Configuration &config, ThreadPool &pool );
+    void ReadFields( BlockParser &, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection, ThreadPool &pool );
+    void ReadEfields( BlockParser &, const Units &units, Configuration &config, ThreadPool &pool );
     void ReadSystems( BlockParser &, const Units &units, Configuration &config );
     void ReadPermChargeSets( BlockParser &, const Units &units, Configuration &config );
     void ReadPermDipoleSets( BlockParser &, const Units &units, Configuration &config );
+    
+    /*
+    **	Reads the systems one at a time together with their GRID, FIELD, EFIELD and PERM blocks, and builds the normal
+    **	equations ( System::OnUpdate2 ) of each complete system on the pool while the next one is read. The files are
+    **	merged into the parser one by one, so a system is read as soon as the files that hold it are indexed; a block
+    **	in a later file than its system updates that system once more. At most maxPending systems wait for their
+    **	update, reading blocks until one of them is done. Returns the seconds spent waiting for the updates.
+    */
+    F64 ReadAndUpdateSystems( BlockParser &, const Units &units, Configuration &config, 
+                              const std::vector< U32 > &collectionSelection, ThreadPool &pool, size_t maxPending );
 
     System* ReadSystem( const Block &, const Units &units );
 
-    void ReadGrid( const Block &, const Units &units, Configuration &config );
-    void ReadField( const Block &, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection );
-    void ReadEfield( const Block &, const Units &units, Configuration &config );
+    void ReadGrid( const Block &, const Units &units, Configuration &config, ThreadPool &pool );
+    void ReadField( const Block &, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection, ThreadPool &pool );
+    void ReadEfield( const Block &, const Units &units, Configuration &config, ThreadPool &pool );
     void ReadPermChargeSet( const Block &, const Units &units, Configuration &config );
     void ReadPermDipoleSet( const Block &, const Units &units, Configuration &config );
 }
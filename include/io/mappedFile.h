@@ -0,0 +1,93 @@
+#pragma once
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+#include "common/types.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <condition_variable>
+
+#include <sys/types.h>
+
+namespace FieldFit
+{
+    /*
+    **  Read-only memory mapping of an input file, the mapping lives as long as the object. Inputs that
+    **  cannot be mapped, "-" for stdin and named pipes, are read on a separate thread into reserved
+    **  address space, and gzip compressed inputs are decompressed on one. Available() lets a parser
+    **  follow that thread, while End() and Size() wait until it is done.
+    */
+    class MappedFile
+    {
+    public:
+
+        MappedFile( const std::string &file );
+        ~MappedFile();
+
+        MappedFile( const MappedFile & ) = delete;
+        MappedFile &operator=( const MappedFile & ) = delete;
+
+        const char *Data() const;
+        const char *End() const;
+
+        size_t Size() const;
+
+        // waits until more than offset bytes are available or the input is complete, returns the available bytes
+        size_t Available( size_t offset ) const;
+
+        // drops the pages that lie entirely within [begin, end) from memory, a mapped file reads them again
+        // on access, while streamed or decompressed contents are lost, so only release what was consumed
+        void Release( const char *begin, const char *end ) const;
+
+        const std::string &GetName() const;
+
+    private:
+
+        // reserves address space for contents of at most size bytes, which never move once written
+        void Reserve( size_t size );
+
+        void StartStream( const int fd, bool closeFd );
+        void ReadStream( const int fd, bool closeFd );
+
+        // reads at most count bytes as they arrive, 0 at the end of the stream or when stopping, -1 on errors
+        ssize_t ReadSome( const int fd, char *buffer, size_t count ) const;
+
+        void StartInflate();
+
+        // from the mapped input when fd is negative, otherwise from the stream, after the mRawSize bytes in mBuffer
+        void Inflate( const int fd );
+
+        // publishes the end of the contents and any error to a following parser
+        void Complete( size_t size, const std::string &error );
+
+        std::string mName;
+
+        // the input as it is stored when mapped, the buffer holds compressed input read from a stream
+        const char *mRaw;
+        size_t mRawSize;
+        bool mMapped;
+        std::vector< char > mBuffer;
+
+        // address space reserved for streamed or decompressed contents
+        char *mReservation;
+        size_t mReserved;
+
+        // reads the stream or decompresses the input
+        std::thread mProducer;
+        mutable std::mutex mMutex;
+        mutable std::condition_variable mCondition;
+        std::atomic< size_t > mAvailable;
+        std::atomic< bool > mComplete;
+        std::atomic< bool > mStopping;
+        std::string mError;
+
+        const char *mData;
+        size_t mSize;
+    };
+}
+
+#endif
@@ -0,0 +1,62 @@
+#pragma once
+#ifndef __NPYARRAY_H__
+#define __NPYARRAY_H__
+
+#include "common/types.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace FieldFit
+{
+    class Block;
+    class MappedFile;
+
+    /*
+    **  A float64 NumPy .npy array of one or two dimensions, mapped and used in place. Instead of listing
+    **  their values, GRID and FIELD blocks can reference such a file after their size indicators:
+    **
+    **      GRID
+    **       S0 2000 grid.npy
+    **      END
+    **
+    **  Relative paths are taken from the directory of the file that holds the block, so a field file
+    **  and its arrays can be moved together; blocks read from stdin use the working directory.
+    */
+    class NpyArray
+    {
+    public:
+
+        NpyArray( const std::string &file );
+
+        // the referenced file when the body of the block is a single .npy file name, empty otherwise,
+        // a relative name is resolved against the directory of the file of the block
+        static std::string Reference( const Block &block );
+
+        // true for a rows x cols array, a one dimensional array counts as a single column
+        bool HasShape( size_t rows, size_t cols ) const;
+
+        // the columns are contiguous, so they can be used in place
+        bool IsColumnMajor() const;
+
+        const F64 *Data() const;
+
+        F64 At( size_t row, size_t col ) const;
+
+        // keeps Data() alive
+        std::shared_ptr< const void > GetSource() const;
+
+        const std::string &GetName() const;
+
+    private:
+
+        std::shared_ptr< const MappedFile > mFile;
+        const F64 *mData;
+
+        std::vector< size_t > mShape;
+        bool mFortranOrder;
+    };
+}
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+#ifndef __NUMBERPARSER_H__
+#define __NUMBERPARSER_H__
+
+#include "common/types.h"
+
+namespace FieldFit
+{
+    /*
+    **  Allocation free conversion of a character range into a number. The whole range has to be
+    **  consumed, otherwise the conversion fails and false is returned.
+    **
+    **  Floating point values accept the usual C notation as well as Fortran style exponents
+    **  ( 0.157077038013309078E-002, 1.0D-02 ) and are correctly rounded.
+    */
+    namespace NumberParser
+    {
+        bool Parse( const char *begin, const char *end, F64 &value );
+        bool Parse( const char *begin, const char *end, F32 &value );
+        bool Parse( const char *begin, const char *end, U32 &value );
+        bool Parse( const char *begin, const char *end, S32 &value );
+        bool Parse( const char *begin, const char *end, U64 &value );
+    }
+}
+
+#endif
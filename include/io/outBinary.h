@@ -0,0 +1,22 @@
+#pragma once
+#ifndef __OUTBINARY_H__
+#define __OUTBINARY_H__
+
+#include "common/types.h"
+#include "io/units.h"
+
+#include <string>
+
+namespace FieldFit
+{
+    class BlockParser;
+
+    /*
+    **  Writes all SYSTEM, GRID, FIELD, EFIELD, PERMCHARGES and PERMDIPOLES blocks into a binary
+    **  container ( see binaryFormat.h ) and returns the number of written blocks. The values are
+    **  converted to internal units, all other blocks ( UNITS, constraints ) are not part of the container.
+    */
+    size_t WriteBinary( const BlockParser &bp, const Units &units, const std::string &file );
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __TOKENCHUNKS_H__
+#define __TOKENCHUNKS_H__
+
+#include "io/block.h"
+#include "io/tokenStream.h"
+
+#include "common/threadPool.h"
+
+#include <future>
+#include <string>
+#include <vector>
+
+namespace FieldFit
+{
+    /*
+    **	Splits the untokenized body of a block into newline aligned chunks, so that large numeric
+    **	bodies can be converted in parallel. With more than one chunk, the tokens of all chunks are
+    **	counted first, so that the position of every token is known before any value is written.
+    */
+    class TokenChunks
+    {
+    public:
+
+    	TokenChunks( const Block &block, size_t expectedTokens, ThreadPool &pool );
+
+    	/*
+    	**	Calls function( stream, first, count ) for every chunk on the pool, where first is the index
+    	**	of the first token of the chunk within the body. Returns false, without converting anything
+    	**	when possible, if the body does not hold exactly the expected number of tokens.
+    	*/
+    	template< class Function >
+    	bool ForEach( Function function );
+
+    private:
+
+    	std::string mTitle;
+    	size_t mHeaderSize;
+    	size_t mExpectedTokens;
+
+    	// chunk c spans [ mBoundaries[c], mBoundaries[c+1] ) and starts at token mFirst[c]
+    	std::vector< const char* > mBoundaries;
+    	std::vector< size_t > mFirst;
+
+    	ThreadPool &mPool;
+    };
+
+    template< class Function >
+    bool TokenChunks::ForEach( Function function )
+    {
+    	const size_t numChunks = mBoundaries.size() - 1;
+
+    	// nothing was counted, so let the single chunk find out on its own
+    	if ( numChunks == 1 )
+    	{
+    		TokenStream stream( mTitle, mBoundaries[0], mBoundaries[1], mHeaderSize );
+    		function( stream, 0, mExpectedTokens );
+
+    		return stream.AtEnd();
+    	}
+
+    	if ( mFirst.back() != mExpectedTokens )
+    	{
+    		return false;
+    	}
+
+    	std::vector< std::future< void > > results;
+
+    	for ( size_t c=0; c < numChunks; ++c )
+    	{
+    		results.push_back( mPool.Submit( [this, c, &function]()
+    		{
+    			TokenStream stream( mTitle, mBoundaries[c], mBoundaries[c+1], mHeaderSize + mFirst[c] );
+    			function( stream, mFirst[c], mFirst[c+1] - mFirst[c] );
+    		} ) );
+    	}
+
+    	// all chunks write into the same destination, so they must be done before an error leaves the reader,
+    	// which converts queued chunks itself in the meantime rather than idling behind other work on the pool
+    	for ( std::future< void > &result : results )
+    	{
+    		mPool.Wait( result );
+    	}
+
+    	for ( std::future< void > &result : results )
+    	{
+    		result.get();
+    	}
+
+    	return true;
+    }
+}
+
+#endif
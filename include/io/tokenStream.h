@@ -0,0 +1,72 @@
+#ifndef __TOKENSTREAM_H__
+#define __TOKENSTREAM_H__
+
+#include "io/block.h"
+
+#include "common/util.h"
+#include "common/exception.h"
+
+#include <string>
+
+namespace FieldFit
+{
+    /*
+    **	Sequential access to the untokenized body of a block. Tokens that are not needed can be skipped
+    **	by only scanning the characters, without ever materializing them.
+    */
+    class TokenStream
+    {
+    public:
+
+    	TokenStream( const Block &block );
+    	
+    	// part of the body of a block, where index is the index of its first token within the block
+    	TokenStream( const std::string &title, const char *begin, const char *end, size_t index );
+
+    	std::string NextToken();
+
+    	template< class T >
+    	T NextValue();
+
+    	void Skip( size_t count );
+    	
+    	// skips all remaining tokens and returns how many there were
+    	size_t SkipAll();
+
+    	// true when no tokens are left, also consumes trailing comments
+    	bool AtEnd();
+
+    	// index of the next token within the block, counting the tokenized header
+    	size_t Index() const;
+
+    private:
+
+    	bool Advance( const char *&begin, const char *&end );
+    	void Next( const char *&begin, const char *&end );
+
+    	void SkipDelimiters();
+
+    	std::string mTitle;
+    	const char *mPosition;
+    	const char *mEnd;
+    	size_t mIndex;
+    };
+
+    template< class T >
+    T TokenStream::NextValue()
+    {
+    	const char *begin, *end;
+    	Next( begin, end );
+
+    	T value;
+
+    	if ( !NumberParser::Parse( begin, end, value ) )
+    	{
+    		throw ArgException( "Block", "GetValue", "block ["+mTitle+"] token "+Util::ToString( mIndex - 1 )+" has malformed numeric value '"+std::string( begin, end )+"'" );
+    	}
+
+    	return value;
+    }
+}
+
+#endif
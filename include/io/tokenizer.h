@@ -1,32 +1,37 @@
 #ifndef __TOKENIZER_H__
 #define __TOKENIZER_H__
 
+#include "io/block.h"
+
 #include <vector>
 #include <string>
 
 namespace FieldFit
 {
     /*
-    **	Class to transform a string containing whitespace, tabs and tokens to a vector of tokens;
+    **	Class to split a range of characters containing whitespace, tabs and tokens into a vector of token views;
     */
     class Tokenizer
     {
     public:
     	
-    	void Tokenize( const std::string &line, const std::string &delimiters );
+    	Tokenizer( const std::string &delimiters );
+    	
+    	void Tokenize( const char *begin, const char *end );
     	void Empty();
     	
     	bool IsEnd();
     	
     	size_t Size();
     	
-    	const std::vector< std::string > & GetBuffer();
+    	std::vector< Block::Token > & GetBuffer();
     	
     private:
     		
-    	std::vector< std::string > mBuffer;
+    	bool mDelimiters[256];
+    	std::vector< Block::Token > mBuffer;
     };
 
 }
 
-#endif
\ No newline at end of file
+#endif
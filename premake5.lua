@@ -80,13 +80,22 @@ workspace "FieldFit"
         
     filter {}
 
+--  the wide grid kernels are only called when the cpu supports them, see fitting/delcomp.cpp
+    filter "files:source/fitting/delcompAvx2.cpp"
+        buildoptions { "-mavx2", "-ffp-contract=off" }
+
+    filter "files:source/fitting/delcompAvx512.cpp"
+        buildoptions { "-mavx512f", "-ffp-contract=off" }
+
+    filter {}
+
     project( "FieldFit" )
     
         targetname( "FieldFit" )
         kind "ConsoleApp"
         flags "WinMain"
         
-	   	links { "lapack", "blas" }
+	   	links { "lapack", "blas", "pthread", "z" }
 	    buildoptions "-std=c++11"
         
         defines {
@@ -126,7 +135,7 @@ workspace "FieldFit"
         kind "ConsoleApp"
         flags "WinMain"
         
-        links { "lapack", "blas" }
+        links { "lapack", "blas", "pthread", "z" }
         buildoptions "-std=c++11"
         
         defines {
@@ -163,4 +172,48 @@ workspace "FieldFit"
                 
         filter {}
 
+    project( "FieldFitBench" )
+    
+        targetname( "FieldFitBench" )
+        kind "ConsoleApp"
+        
+        links { "lapack", "blas", "pthread", "z" }
+        buildoptions "-std=c++11"
+        
+        defines {
+                "ARMA_DONT_PRINT_CXX11_WARNING",
+                "ARMA_USE_CXX11",
+                "ARMA_USE_SUPERLU",
+                "ARMA_USE_BLAS",
+                "ARMA_USE_ARPACK"
+            }
+        
+        filter "*Release"
+            defines "ARMA_NO_DEBUG"
+        filter{}        
+                    
+        
+        includedirs {
+                "include/",
+                "bench/",
+                "extern/armadillo-7.600.2/include/",
+                "extern/tclap-1.2.1/include/",
+                "extern/rapidjson-1.1.0/include/"
+            }
+    
+        files { 
+                "include/**.hpp",
+                "include/**.h",
+                "bench/**.h"
+            }
+                
+        files { 
+                "bench/**.cpp",
+                "source/**.cpp"
+                }
+        
+        removefiles "source/main.cpp"
+                
+        filter {}
+
     workspace()
@@ -0,0 +1,48 @@
+#include "common/blasThreads.h"
+
+#if defined( __GNUC__ ) && !defined( _WIN32 )
+
+// resolved at run time, these stay null when the BLAS does not define them
+extern "C"
+{
+    void openblas_set_num_threads( int numThreads ) __attribute__(( weak ));
+    int openblas_get_num_threads() __attribute__(( weak ));
+    
+    void MKL_Set_Num_Threads( int numThreads ) __attribute__(( weak ));
+    int MKL_Get_Max_Threads() __attribute__(( weak ));
+    
+    void bli_thread_set_num_threads( long numThreads ) __attribute__(( weak ));
+    long bli_thread_get_num_threads() __attribute__(( weak ));
+}
+
+size_t FieldFit::SetBlasThreads( size_t numThreads )
+{
+    size_t previous = 0;
+    
+    if ( openblas_set_num_threads && openblas_get_num_threads )
+    {
+        previous = openblas_get_num_threads();
+        openblas_set_num_threads( static_cast< int >( numThreads ) );
+    }
+    else if ( MKL_Set_Num_Threads && MKL_Get_Max_Threads )
+    {
+        previous = MKL_Get_Max_Threads();
+        MKL_Set_Num_Threads( static_cast< int >( numThreads ) );
+    }
+    else if ( bli_thread_set_num_threads && bli_thread_get_num_threads )
+    {
+        previous = bli_thread_get_num_threads();
+        bli_thread_set_num_threads( static_cast< long >( numThreads ) );
+    }
+    
+    return previous;
+}
+
+#else
+
+size_t FieldFit::SetBlasThreads( size_t )
+{
+    return 0;
+}
+
+#endif
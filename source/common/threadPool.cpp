@@ -0,0 +1,86 @@
+#include "common/threadPool.h"
+
+#include <algorithm>
+
+FieldFit::ThreadPool::ThreadPool( size_t numThreads ) :
+    mStopping( false )
+{
+    if ( numThreads == 0 )
+    {
+        numThreads = std::max< size_t >( std::thread::hardware_concurrency(), 1 );
+    }
+
+    // a single thread is the calling thread itself
+    if ( numThreads > 1 )
+    {
+        for ( size_t i=0; i < numThreads; ++i )
+        {
+            mWorkers.push_back( std::thread( &ThreadPool::Run, this ) );
+        }
+    }
+}
+
+FieldFit::ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard< std::mutex > lock( mMutex );
+        mStopping = true;
+    }
+
+    mCondition.notify_all();
+
+    for ( std::thread &worker : mWorkers )
+    {
+        worker.join();
+    }
+}
+
+size_t FieldFit::ThreadPool::NumThreads() const
+{
+    return std::max< size_t >( mWorkers.size(), 1 );
+}
+
+void FieldFit::ThreadPool::Run()
+{
+    while ( true )
+    {
+        std::function< void() > task;
+
+        {
+            std::unique_lock< std::mutex > lock( mMutex );
+            mCondition.wait( lock, [this]() { return mStopping || !mTasks.empty(); } );
+
+            // finish all pending work before stopping
+            if ( mTasks.empty() )
+            {
+                return;
+            }
+
+            task = std::move( mTasks.front() );
+            mTasks.pop();
+        }
+
+        task();
+    }
+}
+
+bool FieldFit::ThreadPool::RunPending()
+{
+    std::function< void() > task;
+
+    {
+        std::lock_guard< std::mutex > lock( mMutex );
+
+        if ( mTasks.empty() )
+        {
+            return false;
+        }
+
+        task = std::move( mTasks.front() );
+        mTasks.pop();
+    }
+
+    task();
+
+    return true;
+}
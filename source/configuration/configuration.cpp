@@ -2,7 +2,11 @@
 
 #include "common/exception.h"
 
-FieldFit::Configuration::Configuration()
+#include <algorithm>
+
+FieldFit::Configuration::Configuration() :
+    mGramTiles( false ), mReleaseCoefficients( false ), mPermTreeTheta( 0.0 ), mMixedPrecision( false ), 
+    mCompactStorage( false ), mBlockSolver( false ), mRefineTolerance( 0.0 )
 {
     
 }
@@ -55,4 +59,108 @@ std::vector<FieldFit::System*> & FieldFit::Configuration::GetSystems()
 const std::vector<FieldFit::System*> &  FieldFit::Configuration::GetSystems() const
 {
     return mSystems;
+}
+
+void FieldFit::Configuration::SetGramTiles( bool gramTiles )
+{
+    mGramTiles = gramTiles;
+}
+
+bool FieldFit::Configuration::GetGramTiles() const
+{
+    return mGramTiles;
+}
+
+void FieldFit::Configuration::SetReleaseCoefficients( bool releaseCoefficients )
+{
+    mReleaseCoefficients = releaseCoefficients;
+}
+
+bool FieldFit::Configuration::GetReleaseCoefficients() const
+{
+    return mReleaseCoefficients;
+}
+
+size_t FieldFit::Configuration::GetReleasedBytes() const
+{
+    size_t bytes = 0;
+    
+    for ( const System *sys : mSystems )
+    {
+        bytes += sys->GetReleasedBytes();
+    }
+    
+    return bytes;
+}
+
+void FieldFit::Configuration::SetPermTreeTheta( F64 theta )
+{
+    if ( theta < 0.0 || theta >= 1.0 )
+    {
+        throw ArgException( "FieldFit", "Configuration::SetPermTreeTheta", "The opening angle of the treecode should lie in [0, 1)" );
+    }
+    
+    mPermTreeTheta = theta;
+}
+
+F64 FieldFit::Configuration::GetPermTreeTheta() const
+{
+    return mPermTreeTheta;
+}
+
+F64 FieldFit::Configuration::GetPermTreeError() const
+{
+    F64 error = 0.0;
+    
+    for ( const System *sys : mSystems )
+    {
+        error = std::max( error, sys->GetPermTreeError() );
+    }
+    
+    return error;
+}
+
+void FieldFit::Configuration::SetMixedPrecision( bool mixedPrecision )
+{
+    mMixedPrecision = mixedPrecision;
+}
+
+bool FieldFit::Configuration::GetMixedPrecision() const
+{
+    return mMixedPrecision;
+}
+
+void FieldFit::Configuration::SetCompactStorage( bool compactStorage )
+{
+    mCompactStorage = compactStorage;
+}
+
+bool FieldFit::Configuration::GetCompactStorage() const
+{
+    return mCompactStorage;
+}
+
+void FieldFit::Configuration::SetBlockSolver( bool blockSolver )
+{
+    mBlockSolver = blockSolver;
+}
+
+bool FieldFit::Configuration::GetBlockSolver() const
+{
+    return mBlockSolver;
+}
+
+void FieldFit::Configuration::SetRefineTolerance( F64 tolerance )
+{
+    if ( tolerance < 0.0 )
+    {
+        throw ArgException( "FieldFit", "Configuration::SetRefineTolerance", "The refinement tolerance should not be negative" );
+    }
+    
+    mRefineTolerance = tolerance;
+}
+
+F64 FieldFit::Configuration::GetRefineTolerance() const
+{
+    return mRefineTolerance;
 }
\ No newline at end of file
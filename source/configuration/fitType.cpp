@@ -2,6 +2,8 @@
 
 #include "common/exception.h"
 
+#include <bitset>
+
 U32 FieldFit::StringTypeToFitFlags( const std::string &fitFlags )
 {
     U32 flags = 0;
@@ -165,4 +167,9 @@ bool FieldFit::IsSpecialSet( U32 flags, SpecialFlag sf )
 {
     const U32 flagValue = ( 1 << sf );
     return ( (flags) & (flagValue) ) == (flagValue);
+}
+
+U32 FieldFit::NumFitTypes( U32 flags )
+{
+    return std::bitset< FitType::size >( flags ).count();
 }
\ No newline at end of file
@@ -2,10 +2,28 @@
 
 #include "common/exception.h"
 
+#include "common/threadPool.h"
+
 #include "fitting/delcomp.h"
+#include "fitting/permTree.h"
 
 #include <iostream>
 #include <cmath>
+#include <future>
+#include <algorithm>
+
+namespace
+{
+    // below this many grid points per chunk a system is not split
+    const size_t gChunkRows = 1 << 15;
+    const size_t gMaxChunks = 256;
+    
+    // bounds the memory of the partial normal equations of all chunks together
+    const size_t gPartialBytes = 1 << 26;
+    
+    // grid points on which the treecode is compared with direct summation
+    const size_t gPermTreeSamples = 1024;
+}
 
 FieldFit::Site::Site( const U32 types,
                       const std::string &name,
@@ -97,93 +115,146 @@ U32 FieldFit::Site::GetFlags() const
 
 size_t FieldFit::Site::NumColumns() const
 {
-   size_t collOffset = 0;
-    
-   for ( S32 t=0; t < FitType::size; ++t )
-   {
-        FitType fitType = (FitType) t;
-        
-        if ( TestFitType( fitType )  )
-        {
-            collOffset++;
-        }
-    } 
-    
-    return collOffset;
+    return NumFitTypes( mTypes );
 }
 
-FieldFit::PermSite::PermSite( F64 x, F64 y, F64 z, F64 val, FitType type ) :
-    	mCoordX( x ), mCoordY( y ), mCoordZ( z ), mValue( val ), mType( type )
+FieldFit::Grid::Grid( const arma::vec &x,
+        	       	  const arma::vec &y,
+                      const arma::vec &z ) :
+      mGridX( x ), mGridY( y ), mGridZ( z )
 {
     
 }
 
-F64 FieldFit::PermSite::GetCoordX() const
+FieldFit::Grid::Grid( const F64 *x,
+                      const F64 *y,
+                      const F64 *z,
+                      size_t size,
+                      const std::shared_ptr< const void > &source ) :
+      // armadillo only takes mutable memory, but the vectors are never handed out as non const,
+      // they are not strict so that Compact can let go of them
+      mSource( source ),
+      mGridX( const_cast< F64* >( x ), size, false, false ), 
+      mGridY( const_cast< F64* >( y ), size, false, false ), 
+      mGridZ( const_cast< F64* >( z ), size, false, false )
 {
-    return mCoordX;
+    
 }
 
-F64 FieldFit::PermSite::GetCoordY() const
+const arma::vec &FieldFit::Grid::GetX() const
 {
-    return mCoordY;
+    return mGridX;
 }
 
-F64 FieldFit::PermSite::GetCoordZ() const
+const arma::vec &FieldFit::Grid::GetY() const
 {
-    return mCoordZ;
+    return mGridY;
 }
 
-F64 FieldFit::PermSite::GetValue() const
+const arma::vec &FieldFit::Grid::GetZ() const
 {
-    return mValue;
+    return mGridZ;
 }
 
-FieldFit::FitType FieldFit::PermSite::GetType() const
+void FieldFit::Grid::Rows( size_t begin, size_t numPoints, arma::mat &buffer, const F64 *rows[3] ) const
 {
-    return mType;
+    if ( mCompactX.n_elem == 0 )
+    {
+        rows[0] = mGridX.memptr() + begin;
+        rows[1] = mGridY.memptr() + begin;
+        rows[2] = mGridZ.memptr() + begin;
+        
+        return;
+    }
+    
+    buffer.set_size( numPoints, 3 );
+    
+    const F32 *compact[3] = { mCompactX.memptr() + begin, mCompactY.memptr() + begin, mCompactZ.memptr() + begin };
+    
+    for ( U32 d=0; d < 3; ++d )
+    {
+        std::copy( compact[d], compact[d] + numPoints, buffer.colptr( d ) );
+        rows[d] = buffer.colptr( d );
+    }
 }
 
-FieldFit::Grid::Grid( const arma::vec &x,
-        	       	  const arma::vec &y,
-                      const arma::vec &z ) :
-      mGridX( x ), mGridY( y ), mGridZ( z )
+void FieldFit::Grid::Compact()
 {
+    if ( mCompactX.n_elem != 0 || mGridX.n_elem == 0 )
+    {
+        return;
+    }
+    
+    mCompactX = arma::conv_to< arma::fvec >::from( mGridX );
+    mCompactY = arma::conv_to< arma::fvec >::from( mGridY );
+    mCompactZ = arma::conv_to< arma::fvec >::from( mGridZ );
     
+    mGridX.reset();
+    mGridY.reset();
+    mGridZ.reset();
+    mSource.reset();
 }
-const arma::vec &FieldFit::Grid::GetX() const
+
+size_t FieldFit::Grid::Size() const
 {
-    return mGridX;
+    return mCompactX.n_elem != 0 ? mCompactX.n_elem : mGridX.n_elem;
 }
 
-const arma::vec &FieldFit::Grid::GetY() const
+FieldFit::Field::Field( const arma::mat &mat, const std::set< U32 > &collectionSet, U32 preSelectionNumSets ) :
+    mPotentials(mat), mPreSelectionNumSets(preSelectionNumSets), mCollectionSet(collectionSet)
 {
-    return mGridY;
+    
 }
 
-const arma::vec &FieldFit::Grid::GetZ() const
+FieldFit::Field::Field( const F64 *potentials, size_t numPoints, size_t numSets, 
+                        const std::set< U32 > &collectionSet, U32 preSelectionNumSets, const std::shared_ptr< const void > &source ) :
+    mPreSelectionNumSets(preSelectionNumSets), mCollectionSet(collectionSet), mSource(source),
+    mPotentials( const_cast< F64* >( potentials ), numPoints, numSets, false, false )
 {
-    return mGridZ;
+    
 }
 
-size_t FieldFit::Grid::Size()
+const arma::mat &FieldFit::Field::GetPotentials() const
 {
-    return mGridX.n_rows;
+    return mPotentials;
 }
 
-FieldFit::Field::Field( const arma::mat &mat, const std::set< U32 > &collectionSet, U32 preSelectionNumSets ) :
-    mPotentials(mat), mPreSelectionNumSets(preSelectionNumSets), mCollectionSet(collectionSet)
+const F64 *FieldFit::Field::ColumnRows( size_t set, size_t begin, size_t numPoints, arma::vec &buffer ) const
+{
+    if ( mCompactPotentials.n_elem == 0 )
+    {
+        return mPotentials.colptr( set ) + begin;
+    }
+    
+    buffer.set_size( numPoints );
+    
+    const F32 *compact = mCompactPotentials.colptr( set ) + begin;
+    std::copy( compact, compact + numPoints, buffer.memptr() );
+    
+    return buffer.memptr();
+}
+
+void FieldFit::Field::Compact()
 {
+    if ( mCompactPotentials.n_elem != 0 || mPotentials.n_elem == 0 )
+    {
+        return;
+    }
     
+    mCompactPotentials = arma::conv_to< arma::fmat >::from( mPotentials );
+    
+    mPotentials.reset();
+    mSource.reset();
 }
 
-const arma::mat &FieldFit::Field::GetPotentials() const
+size_t FieldFit::Field::NumPoints() const
 {
-    return mPotentials;
+    return mCompactPotentials.n_elem != 0 ? mCompactPotentials.n_rows : mPotentials.n_rows;
 }
 
 U32 FieldFit::Field::NumColumns() const
 {
-    return mPotentials.n_cols;
+    return mCompactPotentials.n_elem != 0 ? mCompactPotentials.n_cols : mPotentials.n_cols;
 }
 
 U32 FieldFit::Field::PreSelectNumSets() const
@@ -196,8 +267,14 @@ const std::set< U32 > &FieldFit::Field::GetCollectionSet() const
     return mCollectionSet;
 }
 
+FieldFit::System::UpdateOptions::UpdateOptions() :
+    gramTiles( false ), releaseCoefficients( false ), permTreeTheta( 0.0 ), mixedPrecision( false ), compactStorage( false )
+{
+    
+}
+
 FieldFit::System::System( const std::string &name ) :
-    mGrid(nullptr), mFields(nullptr), mName( name )
+    mGrid(nullptr), mFields(nullptr), mName( name ), mReleasedBytes( 0 ), mMixedPrecision( false ), mPermTreeError( 0.0 )
 {
     
 }
@@ -214,14 +291,6 @@ FieldFit::System::~System()
         }
     }
     
-    for( PermSite *psite : mPermSites )
-    {
-        if (psite)
-        {
-            delete psite;
-        }
-    }
-    
     if ( mGrid )
     {
         delete mGrid;
@@ -235,48 +304,85 @@ FieldFit::System::~System()
 
 size_t FieldFit::System::NumberOfColumns() const
 {
-    size_t n_col = 0;
+    return NumColumns();
+}
+
+void FieldFit::System::GeneratePermField( size_t begin, size_t numPoints, F64 *field ) const
+{
+    std::fill( field, field + numPoints, 0.0 );
     
-    for( const Site *site : mSites )
+    arma::mat buffer;
+    const F64 *grid[3];
+    mGrid->Rows( begin, numPoints, buffer, grid );
+    
+    if ( mPermTree )
     {
-        for ( S32 t=0; t < FitType::size; ++t )
-        {
-            if ( site->TestFitType((FitType)t) )
-            {
-                n_col++;
-            }
-        }
+        mPermTree->Evaluate( grid[0], grid[1], grid[2], numPoints, field );
+    }
+    else
+    {
+        // the multipoles are summed straight into the field, without a coefficient matrix
+        DelCompPermField( mPermMultipoles.data(), mPermMultipoles.size(), grid[0], grid[1], grid[2], numPoints, field );
     }
+}
+
+const F64 *FieldFit::System::PermFieldRows( size_t begin, size_t numPoints, arma::vec &buffer ) const
+{
+    if ( mPermField.n_elem == mGrid->Size() )
+    {
+        return mPermField.memptr() + begin;
+    }
+    
+    buffer.set_size( numPoints );
+    GeneratePermField( begin, numPoints, buffer.memptr() );
     
-    return n_col;
+    return buffer.memptr();
 }
 
-arma::vec FieldFit::System::GeneratePermField() const
+F64 FieldFit::System::SamplePermTreeError() const
 {
-    arma::vec permValues;
-    arma::mat permCoefficients;
+    const size_t n_points = mGrid->Size();
+    const size_t n_samples = std::min( n_points, gPermTreeSamples );
     
-    const size_t n_col = mPermSites.size();
-    const size_t n_points = mFields->GetPotentials().n_rows;
+    if ( n_samples == 0 )
+    {
+        return 0.0;
+    }
     
-    permValues = arma::zeros( n_col );
-    permCoefficients = arma::zeros( n_points, n_col );
+    // evenly spread over the grid, so the sample does not depend on how the grid is ordered locally
+    const size_t stride = n_points / n_samples;
     
-    U32 col = 0;
-    for ( const PermSite* psite_i : mPermSites )
+    std::vector< F64 > x( n_samples ), y( n_samples ), z( n_samples ), direct( n_samples, 0.0 ), tree( n_samples );
+    
+    arma::mat buffer;
+    const F64 *grid[3];
+    
+    for ( size_t s=0; s < n_samples; ++s )
     {
-        permCoefficients.col( col ) = DelComp( psite_i->GetCoordX(), psite_i->GetCoordY(), psite_i->GetCoordZ(),
-                           	                   mGrid->GetX(), mGrid->GetY(),  mGrid->GetZ(), psite_i->GetType() );
-      
-        permValues[col] = psite_i->GetValue();
-                                          
-        col++;
+        mGrid->Rows( s * stride, 1, buffer, grid );
+        
+        x[s] = *grid[0];
+        y[s] = *grid[1];
+        z[s] = *grid[2];
+        
+        // the tree field of the update itself, evaluating the samples on their own would put them in batches
+        // that span the grid, for which the tree nearly always sums directly
+        tree[s] = mPermField[ s * stride ];
     }
-   
-    return permCoefficients * permValues;
+    
+    DelCompPermField( mPermMultipoles.data(), mPermMultipoles.size(), x.data(), y.data(), z.data(), n_samples, direct.data() );
+    
+    F64 error = 0.0;
+    
+    for ( size_t s=0; s < n_samples; ++s )
+    {
+        error = std::max( error, std::abs( tree[s] - direct[s] ) );
+    }
+    
+    return error;
 }
 
-void FieldFit::System::OnUpdate2()
+void FieldFit::System::OnUpdate2( ThreadPool &pool, const UpdateOptions &options )
 {
     if (!mFields)
     {
@@ -289,50 +395,191 @@ void FieldFit::System::OnUpdate2()
     }
 
     const size_t n_col = NumberOfColumns();
-    const size_t n_sets = mFields->GetPotentials().n_cols;
-    const size_t n_points = mFields->GetPotentials().n_rows;
-    
-    // find out the size we need to rescale
-    mX_prime_x = arma::zeros( n_col, n_col );
-    mX_prime_y = arma::zeros( n_col, n_sets );
-    mCoefficients = arma::zeros( n_points, n_col );
+    const size_t n_sets = mFields->NumColumns();
+    const size_t n_points = mFields->NumPoints();
     
     //std::cout << n_points << " " << n_col << std::endl;
-
-    if ( mPermSites.size() > 0 )
+    
+    mMixedPrecision = options.mixedPrecision;
+    
+    if ( options.compactStorage )
+    {
+        mGrid->Compact();
+        mFields->Compact();
+    }
+    
+    if ( options.permTreeTheta > 0.0 && !mPermMultipoles.empty() )
+    {
+        mPermTree.reset( new PermTree( mPermMultipoles, options.permTreeTheta ) );
+    }
+    
+    mPermField.set_size( n_points );
+    
+    // mixed precision coefficients are of no use to chi2, which evaluates the model again in F64
+    if ( options.gramTiles || options.mixedPrecision )
     {
-        mPermField = GeneratePermField();
+        mCoefficients.reset();
     }
     else
     {
-        mPermField = arma::zeros( n_points );
+        // every column is written by the kernel
+        mCoefficients.set_size( n_points, n_col );
+    }
+    
+    // the partition only depends on the system itself, so the sums do not depend on the number of threads
+    const size_t partialBytes = ( n_col * ( n_col + n_sets ) + n_sets + 1 ) * sizeof( F64 );
+    const size_t numChunks = std::max< size_t >( std::min( { n_points / gChunkRows, gMaxChunks, gPartialBytes / partialBytes } ), 1 );
+    const size_t chunkRows = ( n_points + numChunks - 1 ) / numChunks;
+    
+    if ( numChunks == 1 )
+    {
+        BuildGramChunk( 0, n_points, options, mX_prime_x, mX_prime_y, mY_prime_y );
+    }
+    else
+    {
+        std::vector< arma::mat > xx( numChunks ), xy( numChunks );
+        std::vector< arma::vec > yy( numChunks );
+        std::vector< std::future< void > > chunks;
+        
+        for ( size_t c=0; c < numChunks; ++c )
+        {
+            const size_t begin = std::min( c * chunkRows, n_points ), end = std::min( begin + chunkRows, n_points );
+            
+            chunks.push_back( pool.Submit( [this, c, begin, end, &options, &xx, &xy, &yy]() 
+            { 
+                BuildGramChunk( begin, end, options, xx[c], xy[c], yy[c] ); 
+            } ) );
+        }
+        
+        // all chunks have to finish before anything can be thrown, they refer to this frame
+        for ( std::future< void > &chunk : chunks )
+        {
+            pool.Wait( chunk );
+        }
+        
+        for ( std::future< void > &chunk : chunks )
+        {
+            chunk.get();
+        }
+        
+        // always summed in the same order
+        mX_prime_x = std::move( xx[0] );
+        mX_prime_y = std::move( xy[0] );
+        mY_prime_y = std::move( yy[0] );
+        
+        for ( size_t c=1; c < numChunks; ++c )
+        {
+            mX_prime_x += xx[c];
+            mX_prime_y += xy[c];
+            mY_prime_y += yy[c];
+        }
     }
     
-    //
-    // Todo, generate effective potentials, by subtracting the permanent field
-    //
+    mX_prime_x = arma::symmatu( mX_prime_x );
+    
+    if ( mPermTree )
+    {
+        mPermTreeError = SamplePermTreeError();
+    }
+    
+    if ( options.releaseCoefficients )
+    {
+        // chi2 only needs the normal equations from here on
+        mReleasedBytes = ( mCoefficients.n_elem + mPermField.n_elem ) * sizeof( F64 );
+        
+        mCoefficients.reset();
+        mPermField.reset();
+    }
+}
+
+void FieldFit::System::FillCoefficients( size_t begin, size_t numPoints, F64 *coefficients, size_t stride, bool mixedPrecision ) const
+{
+    arma::mat buffer;
+    const F64 *grid[3];
+    mGrid->Rows( begin, numPoints, buffer, grid );
     
     U32 col = 0;
     for ( const Site* site_i : mSites )
     {
-        //test if we have to include this type
+        // the columns of all included types of the site are filled in a single pass over the grid
+        F64 *columns[ FitType::size ];
+        
         for ( S32 t_i=0; t_i < FitType::size; ++t_i )
         {
-            FitType fitType_i = (FitType) t_i;
+            columns[ t_i ] = site_i->TestFitType((FitType)t_i) ? coefficients + stride * col++ : nullptr;
+        }
+        
+        DelCompSite( site_i->GetCoordX(), site_i->GetCoordY(), site_i->GetCoordZ(), grid[0], grid[1], grid[2], 
+                     numPoints, columns, mixedPrecision );
+    }
+}
+
+size_t FieldFit::System::GramTileRows() const
+{
+    // a tile of coefficients stays within the cache, but remains tall enough for efficient products
+    const size_t tileBytes = 1 << 18;
+    const size_t minRows = 64;
+    
+    return std::max( tileBytes / ( sizeof( F64 ) * std::max< size_t >( NumberOfColumns(), 1 ) ), minRows ) / 8 * 8;
+}
+
+void FieldFit::System::BuildGramChunk( size_t begin, size_t end, const UpdateOptions &options, arma::mat &xx, arma::mat &xy, arma::vec &yy )
+{
+    const bool tiled = options.gramTiles || options.mixedPrecision;
+    
+    const size_t n_col = NumberOfColumns();
+    const size_t n_sets = mFields->NumColumns();
+    const size_t n_tile = std::min( GramTileRows(), end - begin );
+    
+    xx = arma::zeros( n_col, n_col );
+    xy = arma::zeros( n_col, n_sets );
+    yy = arma::zeros( n_sets );
+    
+    GeneratePermField( begin, end - begin, mPermField.memptr() + begin );
+    
+    // without a coefficient matrix the tiles are generated in a buffer of their own
+    arma::mat tile( tiled ? n_tile : 0, n_col );
+    arma::mat target( n_tile, n_sets );
+    arma::vec buffer;
+    
+    const char upper = 'U', trans = 'T', noTrans = 'N';
+    const F64 one = 1.0;
+    const arma::blas_int n = n_col, nSets = n_sets, ldTarget = n_tile;
+    const arma::blas_int ld = tiled ? n_tile : mCoefficients.n_rows;
+    
+    for ( size_t row = begin; row < end; row += n_tile )
+    {
+        const size_t rows = std::min( n_tile, end - row );
+        const arma::blas_int k = rows;
+        
+        F64 *coefficients = tiled ? tile.memptr() : mCoefficients.memptr() + row;
+        
+        FillCoefficients( row, rows, coefficients, ld, options.mixedPrecision );
+        
+        for ( size_t s=0; s < n_sets; ++s )
+        {
+            const F64 *values = mFields->ColumnRows( s, row, rows, buffer );
+            const F64 *perm = mPermField.memptr() + row;
+            F64 *out = target.colptr( s );
             
-            if ( site_i->TestFitType((FitType)t_i) )
+            for ( size_t i=0; i < rows; ++i )
             {
-                mCoefficients.col( col ) = DelComp( site_i->GetCoordX(), site_i->GetCoordY(), site_i->GetCoordZ(),
-                           	                   mGrid->GetX(), mGrid->GetY(),  mGrid->GetZ(), fitType_i );
-                                                  
-                col++;
+                out[i] = values[i] - perm[i];
             }
         }
+        
+        yy += arma::sum( arma::square( target.head_rows( rows ) ), 0 ).t();
+        
+        if ( n_col == 0 )
+        {
+            continue;
+        }
+        
+        // X'X += tile' tile in the upper triangle and X'y += tile' ( V - perm ), while the tile is in cache
+        arma::blas::syrk( &upper, &trans, &n, &k, &one, coefficients, &ld, &one, xx.memptr(), &n );
+        arma::blas::gemm( &trans, &noTrans, &n, &nSets, &k, &one, coefficients, &ld, target.memptr(), &ldTarget, 
+                          &one, xy.memptr(), &n );
     }
-    
-    arma::mat x_prime = arma::trans( mCoefficients );   
-    mX_prime_x = x_prime * mCoefficients;
-    mX_prime_y = x_prime * ( mFields->GetPotentials() - arma::repmat( mPermField, 1, n_sets ) );
 }
 
 FieldFit::Site * FieldFit::System::FindSite( const std::string &name )
@@ -398,14 +645,9 @@ void FieldFit::System::InsertField( Field *field )
     mFields = field;
 }
 
-void FieldFit::System::InsertPermSite( PermSite *site )
+void FieldFit::System::InsertPermMultipole( const PermMultipole &multipole )
 {
-    if (!site)
-    {
-        throw ArgException( "FieldFit", "System::InsertPermSite", "Inserting a null psite in system "+mName );
-    }
-    
-    mPermSites.push_back(site);
+    mPermMultipoles.push_back( multipole );
 }
 
 const std::string &FieldFit::System::GetName() const
@@ -438,17 +680,122 @@ const arma::mat &FieldFit::System::PotentialMatrix() const
     return mX_prime_y;
 }
 
-const F64 FieldFit::System::ComputeChi2( arma::vec result, size_t collIndex ) const
+arma::vec FieldFit::System::ComputeChi2( const arma::mat &coefficients ) const
 {
-    if ( !mFields || collIndex >= mFields->GetPotentials().n_cols )
+    if ( !mFields || coefficients.n_rows != NumberOfColumns() || coefficients.n_cols != mFields->NumColumns() )
     {
-        throw ArgException( "FieldFit", "System::ComputeChi2", "Tried to access a field column that does not exist " );
+        throw ArgException( "FieldFit", "System::ComputeChi2", "The coefficients do not match the columns and collections of system "+mName );
+    }
+    
+    const size_t n_sets = mFields->NumColumns();
+    const size_t n_points = mFields->NumPoints();
+    
+    arma::vec chi2 = arma::zeros( n_sets );
+    arma::vec values;
+    
+    if ( mMixedPrecision )
+    {
+        // a single pass over tiles of the grid for all collections, so every tile and its permanent field are only generated once
+        const size_t n_tile = GramTileRows();
+        
+        arma::mat tile, model;
+        arma::vec perm;
+        
+        for ( size_t row = 0; row < n_points; row += n_tile )
+        {
+            const size_t rows = std::min( n_tile, n_points - row );
+            
+            tile.set_size( rows, NumberOfColumns() );
+            FillCoefficients( row, rows, tile.memptr(), rows, false );
+            
+            const F64 *permField = PermFieldRows( row, rows, perm );
+            
+            model = tile * coefficients;
+            
+            for ( size_t s=0; s < n_sets; ++s )
+            {
+                chi2[s] += SquaredResiduals( mFields->ColumnRows( s, row, rows, values ), permField, model.colptr( s ), rows );
+            }
+        }
+        
+        return chi2;
     }
     
-    arma::vec diffE = ( mFields->GetPotentials().col(collIndex) - mPermField ) - (mCoefficients * result);
-    arma::vec chi2 = arma::trans(diffE) * diffE;
+    for ( size_t s=0; s < n_sets; ++s )
+    {
+        const arma::vec result = coefficients.col( s );
+        
+        if ( mCoefficients.n_rows != n_points || mPermField.n_elem != n_points )
+        {
+            // ( y - Xb )'( y - Xb ) = y'y - 2 b'X'y + b'X'Xb, rounding can make it slightly negative for exact fits
+            chi2[s] = std::max( mY_prime_y[s] - 2.0 * arma::dot( result, mX_prime_y.col( s ) ) + 
+                                arma::dot( result, mX_prime_x * result ), 0.0 );
+        }
+        else
+        {
+            const arma::vec model = mCoefficients * result;
+            
+            chi2[s] = SquaredResiduals( mFields->ColumnRows( s, 0, n_points, values ), mPermField.memptr(), model.memptr(), n_points );
+        }
+    }
+    
+    return chi2;
+}
+
+size_t FieldFit::System::GetReleasedBytes() const
+{
+    return mReleasedBytes;
+}
+
+F64 FieldFit::System::GetPermTreeError() const
+{
+    return mPermTreeError;
+}
+
+arma::mat FieldFit::System::NormalResiduals( const arma::mat &coefficients ) const
+{
+    const size_t n_col = NumberOfColumns();
+    const size_t n_sets = mFields->NumColumns();
+    const size_t n_points = mFields->NumPoints();
+    const size_t n_tile = GramTileRows();
+    
+    arma::mat residuals = arma::zeros( n_col, n_sets );
+    
+    if ( n_col == 0 )
+    {
+        return residuals;
+    }
+    
+    // a single pass over tiles of the grid, each tile only takes a product with b instead of with itself
+    arma::mat tile, target;
+    arma::vec perm, values;
+    
+    for ( size_t row = 0; row < n_points; row += n_tile )
+    {
+        const size_t rows = std::min( n_tile, n_points - row );
+        
+        tile.set_size( rows, n_col );
+        FillCoefficients( row, rows, tile.memptr(), rows, false );
+        
+        const F64 *permField = PermFieldRows( row, rows, perm );
+        
+        target = -( tile * coefficients );
+        
+        for ( size_t s=0; s < n_sets; ++s )
+        {
+            const F64 *observed = mFields->ColumnRows( s, row, rows, values );
+            F64 *out = target.colptr( s );
+            
+            for ( size_t i=0; i < rows; ++i )
+            {
+                out[i] += observed[i] - permField[i];
+            }
+        }
+        
+        residuals += tile.t() * target;
+    }
     
-    return chi2[0];
+    return residuals;
 }
 
 size_t FieldFit::System::NumColumns() const
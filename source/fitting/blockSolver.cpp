@@ -0,0 +1,341 @@
+#include "fitting/blockSolver.h"
+
+#include "common/threadPool.h"
+#include "common/blasThreads.h"
+
+#include <limits>
+#include <future>
+#include <algorithm>
+
+namespace
+{
+    // tasks per thread, blocks differ in size so a few more than one keeps the threads busy
+    const size_t gTasksPerThread = 4;
+
+    // the corrections of a solve, they converge linearly
+    const size_t gMaxCorrections = 10;
+    const F64 gCorrectionTolerance = 1e-14;
+}
+
+FieldFit::BlockSolver::BlockSolver( std::vector< arma::mat > &&blocks, const arma::sp_mat &constraints, ThreadPool &pool ) :
+    mConstraints( constraints ), mNumColumns( 0 ), mPool( pool )
+{
+    mBlocks.resize( blocks.size() );
+
+    for ( size_t b=0; b < blocks.size(); ++b )
+    {
+        mBlocks[b].first = mNumColumns;
+        mNumColumns += blocks[b].n_cols;
+
+        // the collections of a system follow each other, with the same matrix unless a restraint differs
+        if ( !mGroups.empty() && arma::size( mGroups.back().matrix ) == arma::size( blocks[b] ) &&
+             std::equal( blocks[b].begin(), blocks[b].end(), mGroups.back().matrix.begin() ) )
+        {
+            mGroups.back().end = b + 1;
+            continue;
+        }
+
+        Group group;
+        group.matrix = std::move( blocks[b] );
+        group.begin = b;
+        group.end = b + 1;
+
+        mGroups.push_back( std::move( group ) );
+    }
+}
+
+template< class Function >
+void FieldFit::BlockSolver::ForEachGroup( Function function ) const
+{
+    // a single group can use the threads of the BLAS instead
+    if ( mGroups.size() == 1 )
+    {
+        function( 0 );
+        return;
+    }
+
+    const size_t numTasks = std::max< size_t >( std::min( mGroups.size(), gTasksPerThread * mPool.NumThreads() ), 1 );
+    const size_t groupsPerTask = ( mGroups.size() + numTasks - 1 ) / numTasks;
+
+    // every task works on groups of its own, each BLAS call stays on its thread
+    const size_t blasThreads = SetBlasThreads( 1 );
+
+    std::vector< std::future< void > > tasks;
+
+    for ( size_t begin=0; begin < mGroups.size(); begin += groupsPerTask )
+    {
+        const size_t end = std::min( begin + groupsPerTask, mGroups.size() );
+
+        tasks.push_back( mPool.Submit( [&function, begin, end]()
+        {
+            for ( size_t g = begin; g < end; ++g )
+            {
+                function( g );
+            }
+        } ) );
+    }
+
+    // all tasks have to finish before anything can be thrown, they refer to this frame
+    for ( std::future< void > &task : tasks )
+    {
+        mPool.Wait( task );
+    }
+
+    if ( blasThreads > 0 )
+    {
+        SetBlasThreads( blasThreads );
+    }
+
+    for ( std::future< void > &task : tasks )
+    {
+        task.get();
+    }
+}
+
+bool FieldFit::BlockSolver::Factor()
+{
+    std::vector< char > positive( mGroups.size(), 0 );
+
+    ForEachGroup( [this, &positive]( size_t g )
+    {
+        Group &group = mGroups[g];
+        const size_t n = group.matrix.n_cols;
+
+        if ( n == 0 )
+        {
+            positive[g] = 1;
+            return;
+        }
+
+        if ( !arma::chol( group.factor, group.matrix ) )
+        {
+            return;
+        }
+
+        positive[g] = 1;
+
+        size_t numCouplings = 0;
+
+        for ( size_t b = group.begin; b < group.end; ++b )
+        {
+            Block &block = mBlocks[b];
+
+            // the columns of C that fall in the block, most constraints do not touch it at all
+            const arma::sp_mat columns = mConstraints.cols( block.first, block.first + n - 1 );
+
+            std::vector< arma::uword > rows;
+
+            for ( arma::sp_mat::const_iterator it = columns.begin(); it != columns.end(); ++it )
+            {
+                rows.push_back( it.row() );
+            }
+
+            std::sort( rows.begin(), rows.end() );
+            rows.erase( std::unique( rows.begin(), rows.end() ), rows.end() );
+
+            block.constraints = arma::uvec( rows );
+            block.coupling = arma::zeros( rows.size(), n );
+
+            for ( arma::sp_mat::const_iterator it = columns.begin(); it != columns.end(); ++it )
+            {
+                const size_t row = std::lower_bound( rows.begin(), rows.end(), it.row() ) - rows.begin();
+                block.coupling( row, it.col() ) = *it;
+            }
+
+            numCouplings += rows.size();
+        }
+
+        if ( numCouplings == 0 )
+        {
+            return;
+        }
+
+        // the coefficients of the blocks can differ, e.g. for alpha, but they share A^-1
+        arma::mat couplings( n, numCouplings );
+
+        for ( size_t b = group.begin, col = 0; b < group.end; col += mBlocks[b].constraints.n_elem, ++b )
+        {
+            if ( mBlocks[b].constraints.n_elem > 0 )
+            {
+                couplings.cols( col, col + mBlocks[b].constraints.n_elem - 1 ) = mBlocks[b].coupling.t();
+            }
+        }
+
+        const arma::mat weights = SolveGroup( group, couplings );
+
+        for ( size_t b = group.begin, col = 0; b < group.end; col += mBlocks[b].constraints.n_elem, ++b )
+        {
+            if ( mBlocks[b].constraints.n_elem > 0 )
+            {
+                mBlocks[b].weights = weights.cols( col, col + mBlocks[b].constraints.n_elem - 1 );
+            }
+        }
+    } );
+
+    if ( std::find( positive.begin(), positive.end(), 0 ) != positive.end() )
+    {
+        return false;
+    }
+
+    if ( mConstraints.n_rows == 0 )
+    {
+        return true;
+    }
+
+    arma::mat schur = arma::zeros( mConstraints.n_rows, mConstraints.n_rows );
+
+    // summed in block order, so the result does not depend on the number of threads
+    for ( const Block &block : mBlocks )
+    {
+        if ( block.constraints.n_elem > 0 )
+        {
+            schur.submat( block.constraints, block.constraints ) += block.coupling * block.weights;
+        }
+    }
+
+    return arma::chol( mSchurFactor, schur );
+}
+
+arma::vec FieldFit::BlockSolver::Solve( const arma::vec &rhs ) const
+{
+    // the Schur complement squares the conditioning of the blocks in the multipliers, so the
+    // solution is corrected against the blocks themselves until it reaches that of a dense solve
+    arma::vec solution = SolveFactored( rhs );
+    
+    F64 change = std::numeric_limits< F64 >::infinity();
+    
+    for ( size_t step=0; step < gMaxCorrections; ++step )
+    {
+        const arma::vec correction = SolveFactored( rhs - Multiply( solution ) );
+        solution += correction;
+        
+        const F64 previous = change;
+        change = arma::abs( correction ).max() / std::max( arma::abs( solution ).max(), std::numeric_limits< F64 >::min() );
+        
+        // once a step no longer halves the change, rounding has taken over
+        if ( change < gCorrectionTolerance || change > 0.5 * previous )
+        {
+            break;
+        }
+    }
+    
+    return solution;
+}
+
+arma::vec FieldFit::BlockSolver::Multiply( const arma::vec &solution ) const
+{
+    const size_t numConstraints = mConstraints.n_rows;
+
+    arma::vec product = arma::zeros( mNumColumns + numConstraints );
+
+    ForEachGroup( [this, &solution, &product]( size_t g )
+    {
+        const Group &group = mGroups[g];
+
+        if ( group.matrix.n_cols > 0 )
+        {
+            ScatterColumns( group, group.matrix * GatherColumns( group, solution ), product );
+        }
+    } );
+
+    if ( numConstraints > 0 )
+    {
+        const arma::vec parameters = solution.head( mNumColumns );
+        const arma::vec multipliers = solution.tail( numConstraints );
+
+        product.head( mNumColumns ) += mConstraints.t() * multipliers;
+        product.tail( numConstraints ) = mConstraints * parameters;
+    }
+
+    return product;
+}
+
+size_t FieldFit::BlockSolver::NumBlocks() const
+{
+    return mBlocks.size();
+}
+
+size_t FieldFit::BlockSolver::NumFactorizations() const
+{
+    return mGroups.size();
+}
+
+arma::vec FieldFit::BlockSolver::SolveFactored( const arma::vec &rhs ) const
+{
+    const size_t numConstraints = mConstraints.n_rows;
+
+    arma::vec solution = arma::zeros( mNumColumns + numConstraints );
+
+    // all blocks of a group at once
+    ForEachGroup( [this, &rhs, &solution]( size_t g )
+    {
+        const Group &group = mGroups[g];
+
+        if ( group.matrix.n_cols > 0 )
+        {
+            ScatterColumns( group, SolveGroup( group, GatherColumns( group, rhs ) ), solution );
+        }
+    } );
+
+    if ( numConstraints == 0 )
+    {
+        return solution;
+    }
+
+    // S l = C A^-1 b - d, after which x = A^-1 b - A^-1 C' l
+    const arma::vec unconstrained = solution.head( mNumColumns );
+    const arma::vec violation = mConstraints * unconstrained - rhs.tail( numConstraints );
+
+    const arma::vec half = arma::solve( arma::trimatl( mSchurFactor.t() ), violation );
+    const arma::vec multipliers = arma::solve( arma::trimatu( mSchurFactor ), half );
+
+    ForEachGroup( [this, &multipliers, &solution]( size_t g )
+    {
+        const Group &group = mGroups[g];
+
+        for ( size_t b = group.begin; b < group.end; ++b )
+        {
+            const Block &block = mBlocks[b];
+
+            if ( block.constraints.n_elem > 0 )
+            {
+                solution.rows( block.first, block.first + group.matrix.n_cols - 1 ) -= block.weights * multipliers.elem( block.constraints );
+            }
+        }
+    } );
+
+    solution.tail( numConstraints ) = multipliers;
+
+    return solution;
+}
+
+arma::mat FieldFit::BlockSolver::SolveGroup( const Group &group, const arma::mat &rhs ) const
+{
+    const arma::mat half = arma::solve( arma::trimatl( group.factor.t() ), rhs );
+
+    return arma::solve( arma::trimatu( group.factor ), half );
+}
+
+arma::mat FieldFit::BlockSolver::GatherColumns( const Group &group, const arma::vec &vector ) const
+{
+    const size_t n = group.matrix.n_cols;
+
+    arma::mat columns( n, group.end - group.begin );
+
+    for ( size_t b = group.begin; b < group.end; ++b )
+    {
+        columns.col( b - group.begin ) = vector.rows( mBlocks[b].first, mBlocks[b].first + n - 1 );
+    }
+
+    return columns;
+}
+
+void FieldFit::BlockSolver::ScatterColumns( const Group &group, const arma::mat &columns, arma::vec &vector ) const
+{
+    const size_t n = group.matrix.n_cols;
+
+    for ( size_t b = group.begin; b < group.end; ++b )
+    {
+        vector.rows( mBlocks[b].first, mBlocks[b].first + n - 1 ) = columns.col( b - group.begin );
+    }
+}
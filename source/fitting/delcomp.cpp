@@ -1,7 +1,169 @@
 #include "fitting/delcomp.h"
+#include "fitting/delcompKernels.h"
 
 #include "configuration/fitType.h"
 
+#include "common/exception.h"
+
+#include <cmath>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    using namespace FieldFit;
+    using namespace FieldFit::DelCompKernels;
+    
+    struct ScalarLanes
+    {
+        typedef F64 Vec;
+        
+        static const size_t width = 1;
+        
+        static inline Vec Set1( const F64 value )           { return value; }
+        static inline Vec Load( const F64 *data )           { return *data; }
+        static inline void Store( F64 *data, const Vec &v ) { *data = v; }
+        
+        static inline Vec Add( const Vec &a, const Vec &b ) { return a + b; }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return a - b; }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return a * b; }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return a / b; }
+        static inline Vec Sqrt( const Vec &a )              { return std::sqrt( a ); }
+    };
+    
+    struct ScalarLanes32
+    {
+        typedef F32 Vec;
+        
+        static const size_t width = 1;
+        
+        static inline Vec Set1( const F64 value )           { return static_cast< F32 >( value ); }
+        static inline Vec Load( const F64 *data )           { return static_cast< F32 >( *data ); }
+        static inline void Store( F64 *data, const Vec &v ) { *data = v; }
+        
+        static inline Vec Add( const Vec &a, const Vec &b ) { return a + b; }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return a - b; }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return a * b; }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return a / b; }
+        static inline Vec Sqrt( const Vec &a )              { return std::sqrt( a ); }
+    };
+    
+    const Table gScalar = { &Site< ScalarLanes >, &Site< ScalarLanes32 >, &PermField< ScalarLanes >, 
+                            &Residuals< ScalarLanes > };
+    
+#ifdef __SSE2__
+    // the baseline of x86_64, so it needs no check
+    struct Sse2Lanes
+    {
+        typedef __m128d Vec;
+        
+        static const size_t width = 2;
+        
+        static inline Vec Set1( const F64 value )           { return _mm_set1_pd( value ); }
+        static inline Vec Load( const F64 *data )           { return _mm_loadu_pd( data ); }
+        static inline void Store( F64 *data, const Vec &v ) { _mm_storeu_pd( data, v ); }
+        
+        static inline Vec Add( const Vec &a, const Vec &b ) { return _mm_add_pd( a, b ); }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return _mm_sub_pd( a, b ); }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return _mm_mul_pd( a, b ); }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return _mm_div_pd( a, b ); }
+        static inline Vec Sqrt( const Vec &a )              { return _mm_sqrt_pd( a ); }
+    };
+    
+    struct Sse2Lanes32
+    {
+        typedef __m128 Vec;
+        
+        static const size_t width = 4;
+        
+        static inline Vec Set1( const F64 value )           { return _mm_set1_ps( static_cast< F32 >( value ) ); }
+        static inline Vec Load( const F64 *data )           { return _mm_movelh_ps( _mm_cvtpd_ps( _mm_loadu_pd( data ) ), _mm_cvtpd_ps( _mm_loadu_pd( data + 2 ) ) ); }
+        
+        static inline void Store( F64 *data, const Vec &v ) 
+        { 
+            _mm_storeu_pd( data, _mm_cvtps_pd( v ) ); 
+            _mm_storeu_pd( data + 2, _mm_cvtps_pd( _mm_movehl_ps( v, v ) ) ); 
+        }
+        
+        static inline Vec Add( const Vec &a, const Vec &b ) { return _mm_add_ps( a, b ); }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return _mm_sub_ps( a, b ); }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return _mm_mul_ps( a, b ); }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return _mm_div_ps( a, b ); }
+        static inline Vec Sqrt( const Vec &a )              { return _mm_sqrt_ps( a ); }
+    };
+    
+    const Table gSse2 = { &Site< Sse2Lanes >, &Site< Sse2Lanes32 >, &PermField< Sse2Lanes >, 
+                          &Residuals< Sse2Lanes > };
+#endif
+    
+    bool IsSupported( const KernelIsa isa )
+    {
+#if defined( __GNUC__ ) && defined( __x86_64__ )
+        // the dispatch is already set up during static initialisation
+        __builtin_cpu_init();
+#endif
+        
+        switch ( isa )
+        {
+        case KernelIsa::scalar:
+            
+            return true;
+            
+#ifdef __SSE2__
+        case KernelIsa::sse2:
+            
+            return true;
+#endif
+            
+#if defined( __GNUC__ ) && defined( __x86_64__ )
+        case KernelIsa::avx2:
+            
+            return __builtin_cpu_supports( "avx2" );
+            
+        case KernelIsa::avx512:
+            
+            return __builtin_cpu_supports( "avx512f" );
+#endif
+
+        default:
+            
+            return false;
+        }
+    }
+    
+    const Table &GetTable( const KernelIsa isa )
+    {
+        switch ( isa )
+        {
+#ifdef __SSE2__
+        case KernelIsa::sse2:
+            
+            return gSse2;
+#endif
+            
+#if defined( __GNUC__ ) && defined( __x86_64__ )
+        case KernelIsa::avx2:
+            
+            return gAvx2;
+            
+        case KernelIsa::avx512:
+            
+            return gAvx512;
+#endif
+
+        default:
+            
+            return gScalar;
+        }
+    }
+    
+    KernelIsa gKernelIsa = DetectKernelIsa();
+    const Table *gKernels = &GetTable( gKernelIsa );
+}
+
 namespace FieldFit
 {
     arma::vec DelComp( const F64 posX, const F64 posY, const F64 posZ,
@@ -56,4 +218,129 @@ namespace FieldFit
         
         return arma::zeros( delX.n_elem );
     }
-}
\ No newline at end of file
+    
+    KernelIsa DetectKernelIsa()
+    {
+        for ( S32 isa = KernelIsa::avx512; isa > KernelIsa::scalar; --isa )
+        {
+            if ( IsSupported( ( KernelIsa ) isa ) )
+            {
+                return ( KernelIsa ) isa;
+            }
+        }
+        
+        return KernelIsa::scalar;
+    }
+    
+    KernelIsa GetKernelIsa()
+    {
+        return gKernelIsa;
+    }
+    
+    void SetKernelIsa( KernelIsa isa )
+    {
+        if ( !IsSupported( isa ) )
+        {
+            throw ArgException( "FieldFit", "SetKernelIsa", "Kernel instruction set "+EnumToString( isa )+" is not supported by this cpu" );
+        }
+        
+        gKernelIsa = isa;
+        gKernels = &GetTable( isa );
+    }
+    
+    KernelIsa StringToKernelIsa( const std::string &isa )
+    {
+        for ( S32 i = KernelIsa::scalar; i <= KernelIsa::avx512; ++i )
+        {
+            if ( isa == EnumToString( ( KernelIsa ) i ) )
+            {
+                return ( KernelIsa ) i;
+            }
+        }
+        
+        throw ArgException( "FieldFit", "StringToKernelIsa", "Unknown kernel instruction set "+isa+", expected scalar, sse2, avx2 or avx512" );
+    }
+    
+    std::string EnumToString( KernelIsa isa )
+    {
+        switch ( isa )
+        {
+        case KernelIsa::scalar:
+            
+            return "scalar";
+            
+        case KernelIsa::sse2:
+            
+            return "sse2";
+            
+        case KernelIsa::avx2:
+            
+            return "avx2";
+            
+        case KernelIsa::avx512:
+            
+            return "avx512";
+        }
+        
+        return "unknown";
+    }
+    
+    void DelCompSite( const F64 posX, const F64 posY, const F64 posZ,
+                      const F64 *gridX, const F64 *gridY, const F64 *gridZ, const size_t numPoints,
+                      F64 *const columns[ FitType::size ], const bool mixedPrecision )
+    {
+        if ( mixedPrecision )
+        {
+            const size_t i = gKernels->site32( posX, posY, posZ, gridX, gridY, gridZ, 0, numPoints, columns );
+            
+            Site< ScalarLanes32 >( posX, posY, posZ, gridX, gridY, gridZ, i, numPoints, columns );
+            return;
+        }
+        
+        const size_t i = gKernels->site( posX, posY, posZ, gridX, gridY, gridZ, 0, numPoints, columns );
+        
+        // the points that do not fill a whole vector
+        Site< ScalarLanes >( posX, posY, posZ, gridX, gridY, gridZ, i, numPoints, columns );
+    }
+    
+    void DelCompPermField( const PermMultipole *multipoles, const size_t numMultipoles,
+                           const F64 *gridX, const F64 *gridY, const F64 *gridZ, const size_t numPoints, F64 *field )
+    {
+        // a tile of the field stays in cache while it passes a block of multipoles, which stays in cache for the next tile
+        const size_t tilePoints = 1024;
+        const size_t blockMultipoles = 256;
+        
+        for ( size_t begin = 0; begin < numPoints; begin += tilePoints )
+        {
+            const size_t end = std::min( begin + tilePoints, numPoints );
+            
+            for ( size_t first = 0; first < numMultipoles; first += blockMultipoles )
+            {
+                const PermMultipole *block = multipoles + first;
+                const size_t blockSize = std::min( blockMultipoles, numMultipoles - first );
+                
+                const size_t i = gKernels->permField( block, blockSize, gridX, gridY, gridZ, begin, end, field );
+                
+                PermField< ScalarLanes >( block, blockSize, gridX, gridY, gridZ, i, end, field );
+            }
+        }
+    }
+    
+    F64 SquaredResiduals( const F64 *observed, const F64 *perm, const F64 *model, const size_t numPoints )
+    {
+        F64 partial[ gResidualLanes ] = {};
+        
+        const size_t i = gKernels->residuals( observed, perm, model, 0, numPoints, partial );
+        
+        // the remainder continues the interleaving of the partial sums
+        for ( size_t j = i; j < numPoints; ++j )
+        {
+            const F64 diff = ( observed[j] - perm[j] ) - model[j];
+            
+            partial[ j - i ] += diff * diff;
+        }
+        
+        return ( ( partial[0] + partial[1] ) + ( partial[2] + partial[3] ) ) + 
+               ( ( partial[4] + partial[5] ) + ( partial[6] + partial[7] ) );
+    }
+}
@@ -0,0 +1,60 @@
+#include "fitting/delcompKernels.h"
+
+// compiled with -mavx2 -ffp-contract=off, only called after the cpu reported support
+#include <immintrin.h>
+
+namespace
+{
+    struct Avx2Lanes
+    {
+        typedef __m256d Vec;
+
+        static const size_t width = 4;
+
+        static inline Vec Set1( const F64 value )           { return _mm256_set1_pd( value ); }
+        static inline Vec Load( const F64 *data )           { return _mm256_loadu_pd( data ); }
+        static inline void Store( F64 *data, const Vec &v ) { _mm256_storeu_pd( data, v ); }
+
+        static inline Vec Add( const Vec &a, const Vec &b ) { return _mm256_add_pd( a, b ); }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return _mm256_sub_pd( a, b ); }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return _mm256_mul_pd( a, b ); }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return _mm256_div_pd( a, b ); }
+        static inline Vec Sqrt( const Vec &a )              { return _mm256_sqrt_pd( a ); }
+    };
+
+    struct Avx2Lanes32
+    {
+        typedef __m256 Vec;
+
+        static const size_t width = 8;
+
+        static inline Vec Set1( const F64 value )           { return _mm256_set1_ps( static_cast< F32 >( value ) ); }
+
+        static inline Vec Load( const F64 *data )
+        {
+            return _mm256_insertf128_ps( _mm256_castps128_ps256( _mm256_cvtpd_ps( _mm256_loadu_pd( data ) ) ),
+                                         _mm256_cvtpd_ps( _mm256_loadu_pd( data + 4 ) ), 1 );
+        }
+
+        static inline void Store( F64 *data, const Vec &v )
+        {
+            _mm256_storeu_pd( data, _mm256_cvtps_pd( _mm256_castps256_ps128( v ) ) );
+            _mm256_storeu_pd( data + 4, _mm256_cvtps_pd( _mm256_extractf128_ps( v, 1 ) ) );
+        }
+
+        static inline Vec Add( const Vec &a, const Vec &b ) { return _mm256_add_ps( a, b ); }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return _mm256_sub_ps( a, b ); }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return _mm256_mul_ps( a, b ); }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return _mm256_div_ps( a, b ); }
+        static inline Vec Sqrt( const Vec &a )              { return _mm256_sqrt_ps( a ); }
+    };
+}
+
+namespace FieldFit
+{
+    namespace DelCompKernels
+    {
+        const Table gAvx2 = { &Site< Avx2Lanes >, &Site< Avx2Lanes32 >, &PermField< Avx2Lanes >, 
+                              &Residuals< Avx2Lanes > };
+    }
+}
@@ -0,0 +1,68 @@
+#include "fitting/delcompKernels.h"
+
+// compiled with -mavx512f -ffp-contract=off, only called after the cpu reported support
+#include <immintrin.h>
+
+namespace
+{
+    struct Avx512Lanes
+    {
+        typedef __m512d Vec;
+
+        static const size_t width = 8;
+
+        static inline Vec Set1( const F64 value )           { return _mm512_set1_pd( value ); }
+        static inline Vec Load( const F64 *data )           { return _mm512_loadu_pd( data ); }
+        static inline void Store( F64 *data, const Vec &v ) { _mm512_storeu_pd( data, v ); }
+
+        static inline Vec Add( const Vec &a, const Vec &b ) { return _mm512_add_pd( a, b ); }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return _mm512_sub_pd( a, b ); }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return _mm512_mul_pd( a, b ); }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return _mm512_div_pd( a, b ); }
+
+        // the masked form, since _mm512_sqrt_pd trips -Wmaybe-uninitialized on its undefined source
+        static inline Vec Sqrt( const Vec &a )              { return _mm512_mask_sqrt_pd( a, 0xff, a ); }
+    };
+
+    // AVX-512F alone has no 256 bit float inserts and extracts, so the halves move as doubles; the zero
+    // masked forms again keep -Wmaybe-uninitialized quiet
+    struct Avx512Lanes32
+    {
+        typedef __m512 Vec;
+
+        static const size_t width = 16;
+
+        static inline Vec Set1( const F64 value )           { return _mm512_set1_ps( static_cast< F32 >( value ) ); }
+
+        static inline Vec Load( const F64 *data )
+        {
+            const __m256d low = _mm256_castps_pd( _mm512_maskz_cvtpd_ps( 0xff, _mm512_loadu_pd( data ) ) );
+            const __m256d high = _mm256_castps_pd( _mm512_maskz_cvtpd_ps( 0xff, _mm512_loadu_pd( data + 8 ) ) );
+
+            return _mm512_castpd_ps( _mm512_maskz_insertf64x4( 0xff, _mm512_maskz_insertf64x4( 0xff, _mm512_setzero_pd(), low, 0 ), high, 1 ) );
+        }
+
+        static inline void Store( F64 *data, const Vec &v )
+        {
+            const __m512d halves = _mm512_castps_pd( v );
+
+            _mm512_storeu_pd( data, _mm512_maskz_cvtps_pd( 0xff, _mm256_castpd_ps( _mm512_maskz_extractf64x4_pd( 0xf, halves, 0 ) ) ) );
+            _mm512_storeu_pd( data + 8, _mm512_maskz_cvtps_pd( 0xff, _mm256_castpd_ps( _mm512_maskz_extractf64x4_pd( 0xf, halves, 1 ) ) ) );
+        }
+
+        static inline Vec Add( const Vec &a, const Vec &b ) { return _mm512_add_ps( a, b ); }
+        static inline Vec Sub( const Vec &a, const Vec &b ) { return _mm512_sub_ps( a, b ); }
+        static inline Vec Mul( const Vec &a, const Vec &b ) { return _mm512_mul_ps( a, b ); }
+        static inline Vec Div( const Vec &a, const Vec &b ) { return _mm512_div_ps( a, b ); }
+        static inline Vec Sqrt( const Vec &a )              { return _mm512_mask_sqrt_ps( a, 0xffff, a ); }
+    };
+}
+
+namespace FieldFit
+{
+    namespace DelCompKernels
+    {
+        const Table gAvx512 = { &Site< Avx512Lanes >, &Site< Avx512Lanes32 >, &PermField< Avx512Lanes >, 
+                                &Residuals< Avx512Lanes > };
+    }
+}
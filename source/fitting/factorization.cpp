@@ -0,0 +1,146 @@
+#include "fitting/factorization.h"
+
+#ifdef FIELDFIT_USE_SPARSE
+#include "slu_ddefs.h"
+#endif
+
+bool FieldFit::DenseFactorization::Factor( const arma::mat &matrix )
+{
+    mFactors = matrix;
+    mPivots.resize( matrix.n_rows );
+
+    arma::blas_int n = matrix.n_rows;
+    arma::blas_int info = 0;
+
+    if ( n == 0 )
+    {
+        return true;
+    }
+
+    arma::lapack::getrf( &n, &n, mFactors.memptr(), &n, mPivots.data(), &info );
+
+    return info == 0;
+}
+
+arma::vec FieldFit::DenseFactorization::Solve( const arma::vec &rhs ) const
+{
+    arma::vec solution = rhs;
+
+    arma::blas_int n = mFactors.n_rows;
+    arma::blas_int numRhs = 1;
+    arma::blas_int info = 0;
+    char trans = 'N';
+
+    if ( n > 0 )
+    {
+        // getrs does not write the factors, its interface is just not const
+        arma::lapack::getrs( &trans, &n, &numRhs, const_cast< F64* >( mFactors.memptr() ), &n,
+                             const_cast< arma::blas_int* >( mPivots.data() ), solution.memptr(), &n, &info );
+    }
+
+    return solution;
+}
+
+#ifdef FIELDFIT_USE_SPARSE
+
+struct FieldFit::SparseFactorization::Factors
+{
+    SuperMatrix lower, upper;
+    std::vector< int > colPermutation, rowPermutation;
+    bool factored;
+
+    mutable SuperLUStat_t stat;
+};
+
+FieldFit::SparseFactorization::SparseFactorization() :
+    mFactors( new Factors )
+{
+    mFactors->factored = false;
+    StatInit( &mFactors->stat );
+}
+
+FieldFit::SparseFactorization::~SparseFactorization()
+{
+    if ( mFactors->factored )
+    {
+        Destroy_SuperNode_Matrix( &mFactors->lower );
+        Destroy_CompCol_Matrix( &mFactors->upper );
+    }
+
+    StatFree( &mFactors->stat );
+}
+
+bool FieldFit::SparseFactorization::Factor( const arma::sp_mat &matrix )
+{
+    if ( mFactors->factored )
+    {
+        Destroy_SuperNode_Matrix( &mFactors->lower );
+        Destroy_CompCol_Matrix( &mFactors->upper );
+        mFactors->factored = false;
+    }
+
+    const int n = matrix.n_rows;
+
+    // SuperLU indexes with int, its matrices refer to these while factoring
+    std::vector< F64 > values( matrix.values, matrix.values + matrix.n_nonzero );
+    std::vector< int > rows( matrix.row_indices, matrix.row_indices + matrix.n_nonzero );
+    std::vector< int > colPointers( matrix.col_ptrs, matrix.col_ptrs + matrix.n_cols + 1 );
+
+    SuperMatrix input, permuted;
+    dCreate_CompCol_Matrix( &input, n, n, matrix.n_nonzero, values.data(), rows.data(), colPointers.data(), SLU_NC, SLU_D, SLU_GE );
+
+    // the settings of spsolve
+    superlu_options_t options;
+    set_default_options( &options );
+    options.ColPerm = COLAMD;
+    options.Equil = NO;
+    options.DiagPivotThresh = 1.0;
+    options.PrintStat = NO;
+
+    mFactors->colPermutation.assign( n + 1, 0 );
+    mFactors->rowPermutation.assign( n + 1, 0 );
+
+    get_perm_c( options.ColPerm, &input, mFactors->colPermutation.data() );
+
+    std::vector< int > etree( n + 1 );
+    sp_preorder( &options, &input, mFactors->colPermutation.data(), etree.data(), &permuted );
+
+    GlobalLU_t glu;
+    int info = 0;
+
+    dgstrf( &options, &permuted, sp_ienv( 2 ), sp_ienv( 1 ), etree.data(), nullptr, 0, mFactors->colPermutation.data(),
+            mFactors->rowPermutation.data(), &mFactors->lower, &mFactors->upper, &glu, &mFactors->stat, &info );
+
+    Destroy_CompCol_Permuted( &permuted );
+    Destroy_SuperMatrix_Store( &input );
+
+    // beyond n the factorization ran out of memory before L and U existed
+    mFactors->factored = info >= 0 && info <= n;
+
+    return info == 0;
+}
+
+arma::vec FieldFit::SparseFactorization::Solve( const arma::vec &rhs ) const
+{
+    arma::vec solution = rhs;
+
+    if ( solution.n_elem == 0 )
+    {
+        return solution;
+    }
+
+    SuperMatrix columns;
+    dCreate_Dense_Matrix( &columns, solution.n_elem, 1, solution.memptr(), solution.n_elem, SLU_DN, SLU_D, SLU_GE );
+
+    int info = 0;
+
+    // only reads the factors and permutations, despite the interface
+    dgstrs( NOTRANS, &mFactors->lower, &mFactors->upper, mFactors->colPermutation.data(), mFactors->rowPermutation.data(),
+            &columns, &mFactors->stat, &info );
+
+    Destroy_SuperMatrix_Store( &columns );
+
+    return solution;
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include "fitting/fitter.h"
 
 #include "common/exception.h"
+#include "common/util.h"
 
 #include "configuration/system.h"
 #include "configuration/constraints.h"
@@ -8,8 +9,16 @@
 
 #include <iostream>
 #include <map>
+#include <limits>
+#include <algorithm>
 #include <math.h>
 
+namespace
+{
+    // refinement converges linearly, so this is only reached when the tolerance is out of reach
+    const size_t gMaxRefinements = 20;
+}
+
 FieldFit::Fitter::LocalSystem::LocalSystem() :
     sourceSystem( nullptr )
 {
@@ -27,61 +36,27 @@ FieldFit::Fitter::InternalConstraint::InternalConstraint() :
 //     mTargetCollections.push_back( col );
 // }
 
-void FieldFit::Fitter::Fit( Console &console, const Configuration &config, const Constraints &constraints, bool debug )
+void FieldFit::Fitter::Fit( Console &console, const Configuration &config, const Constraints &constraints, ThreadPool &pool, bool debug )
 {
     //std::cout << "SETUP" << std::endl;
 
     AddConfiguration( console, config );
     AddConstraints( console, constraints );
     
-    //
-    // Add restraints
-    //
-    
-    for ( const InternalConstraint &constr : mInternalRestraints )
+    if ( mInternalConstraints.size() > x_prime_y.n_rows )
     {
-        const F64 sqrt_fc = std::sqrt( constr.fconst );
-        
-        for ( size_t i = 0; i < constr.columns.size(); ++i )
-        {
-            const U32 col_i = constr.columns[i];
-            
-            for ( size_t j = 0; j < constr.columns.size(); ++j )
-            {
-                const U32 col_j = constr.columns[j];
-                
-                x_prime_x.row( col_i )[ col_j ] += constr.coefficients[i] * sqrt_fc *
-                                                   constr.coefficients[j] * sqrt_fc;
-                x_prime_y[ col_i ] += constr.reference / sqrt_fc;
-            }
-        }
+        throw ArgException( "FieldFit", "Fitter::Fit", "The configuration is overconstrained" );
     }
     
-    //
-    // Add contraints to the system
-    //
-    
-    if ( mInternalConstraints.size() > x_prime_x.n_cols )
+    // the debug output prints the assembled matrix
+    if ( config.GetBlockSolver() && !debug && !AddBlockSolver( console, pool ) )
     {
-        throw ArgException( "FieldFit", "Fitter::Fit", "The configuration is overconstrained" );
+        console.Warn( Message( "FieldFit", "Fitter::Fit", "The block solver needs restraints within a single local system and positive definite blocks, using the dense solve" ) );
     }
     
-    size_t row =  x_prime_x.n_rows;
-    x_prime_x.resize( x_prime_x.n_rows + mInternalConstraints.size(), 
-                      x_prime_x.n_cols + mInternalConstraints.size() );
-    x_prime_y.resize( x_prime_y.n_rows + mInternalConstraints.size(), 1 );
-    
-    for ( const InternalConstraint &constr : mInternalConstraints )
+    if ( !mBlockSolver )
     {
-        for ( U32 c=0; c < constr.columns.size(); ++c )
-        {
-            x_prime_x.row( row )[ constr.columns[c] ] = constr.coefficients[c];
-            x_prime_x.col( row )[ constr.columns[c] ] = constr.coefficients[c];
-        }
-        
-        x_prime_y[row] = constr.reference;
-        
-        row++;
+        AddMatrix( console );
     }
 
     //std::cout << "OLS" << std::endl;
@@ -100,22 +75,110 @@ void FieldFit::Fitter::Fit( Console &console, const Configuration &config, const
         std::cout << x_prime_y;
         std::cout << "[END]" << std::endl;
     }
+
+    // refinement solves the same matrix again for every correction, so it is factored once for all of them
+    if ( config.GetRefineTolerance() > 0.0 && !mBlockSolver )
+    {
+        mFactorization.reset( new fit_factorization );
+        
+        if ( !mFactorization->Factor( x_prime_x ) )
+        {
+            // the plain solve reports the singular matrix as usual
+            mFactorization.reset();
+        }
+    }
+    
+    mSolution = Solve( x_prime_y );
     
-    mSolution = FIELDFIT_SOLVE( x_prime_x, x_prime_y );
+    if ( config.GetRefineTolerance() > 0.0 )
+    {
+        Refine( console, config.GetRefineTolerance() );
+    }
     
     WriteSolution(console);
 }
 
+void FieldFit::Fitter::Refine( Console &console, F64 tolerance )
+{
+    if ( mSolution.n_elem == 0 )
+    {
+        return;
+    }
+    
+    size_t steps = 0;
+    F64 change = std::numeric_limits< F64 >::max();
+    F64 previous = std::numeric_limits< F64 >::infinity();
+    
+    // once a step no longer halves the change, rounding in the residual has taken over
+    while ( steps < gMaxRefinements && change > tolerance && change <= 0.5 * previous )
+    {
+        previous = change;
+        
+        arma::vec residual = x_prime_y - Multiply( mSolution );
+        
+        // the systems replace the residual of their own blocks by that of their F64 normal equations,
+        // the restraints and constraints were exact already
+        for ( size_t first = 0; first < mLocalSystems.size(); )
+        {
+            const System *sys = mLocalSystems[first].sourceSystem;
+            const size_t last = SystemEnd( first );
+            
+            const arma::mat &localXPrimeX = sys->GetLocalXPrimeX();
+            const arma::mat &localXPrimeY = sys->PotentialMatrix();
+            
+            if ( sys->NumColumns() > 0 )
+            {
+                const arma::mat coefficients = SystemCoefficients( first, last );
+                const arma::mat exact = sys->NormalResiduals( coefficients );
+                
+                for ( size_t l = first; l < last; ++l )
+                {
+                    const LocalSystem &localSys = mLocalSystems[l];
+                    const U32 c = localSys.collectionIndex;
+                    
+                    residual.rows( localSys.first_row, localSys.last_row ) += exact.col( c ) - 
+                        ( localXPrimeY.col( c ) - localXPrimeX * coefficients.col( c ) );
+                }
+            }
+            
+            first = last;
+        }
+        
+        const arma::vec correction = Solve( residual );
+        mSolution += correction;
+        
+        change = arma::abs( correction ).max() / std::max( arma::abs( mSolution ).max(), std::numeric_limits< F64 >::min() );
+        ++steps;
+    }
+    
+    console.Warn( Message( "", "Fitter::Refine", "Refinement steps: " + Util::ToString( steps ) + ", relative change of the last step: " + 
+                           Util::ToString( change ) ) );
+    
+    if ( change > tolerance )
+    {
+        console.Warn( Message( "FieldFit", "Fitter::Refine", "The refinement did not reach the tolerance of " + Util::ToString( tolerance ) ) );
+    }
+}
+
 void FieldFit::Fitter::WriteSolution(Console &console)
 {
     SystemResult systemResult("", 0);
     
+    // the chi2 of all collections of a system at once, which shares the pass over its grid
+    arma::vec systemChi2;
+    
     // Transfer to local sytem
     size_t row = 0;
-    for ( const LocalSystem &localSys : mLocalSystems )
+    for ( size_t l = 0; l < mLocalSystems.size(); ++l )
     { 
+        const LocalSystem &localSys = mLocalSystems[l];
         const System *sys = localSys.sourceSystem;
         
+        if ( l == 0 || mLocalSystems[l - 1].sourceSystem != sys )
+        {
+            systemChi2 = sys->ComputeChi2( SystemCoefficients( l, SystemEnd( l ) ) );
+        }
+        
         if ( systemResult.name != sys->GetName() )
         {
             if ( systemResult.fitResults.size() > 0 )
@@ -129,7 +192,7 @@ void FieldFit::Fitter::WriteSolution(Console &console)
         const size_t systemCols = sys->NumColumns();
         arma::vec lvec = mSolution.rows( row, row + systemCols - 1 );
         
-        F64 chi2 = sys->ComputeChi2( lvec, localSys.collectionIndex );
+        F64 chi2 = systemChi2[ localSys.collectionIndex ];
         systemResult.chi2.push_back( chi2 );
         systemResult.rmsd.push_back( std::sqrt( chi2 / sys->GetGrid()->Size() ) );
         
@@ -264,23 +327,10 @@ void FieldFit::Fitter::AddConfiguration( Console &console, const Configuration &
             localSys.sourceSystem = sys;
             localSys.collectionIndex = i;
             
-            //
-            // Insert the coefficient matrices
-            //
-            
-            x_prime_x.resize( x_prime_x.n_rows + localXPrimeX.n_rows,
-                              x_prime_x.n_cols + localXPrimeX.n_cols );
-            
-            x_prime_y.resize( x_prime_y.n_rows + localXPrimeY.n_rows, 1 );
-            
             localSys.first_row = rowOrigin;
             localSys.first_col = colOrigin;
             localSys.last_row  = rowOrigin + localXPrimeX.n_rows - 1;
             localSys.last_col  = colOrigin + localXPrimeX.n_cols - 1;
-             
-            x_prime_x.submat( localSys.first_row, localSys.first_col, 
-                              localSys.last_row, localSys.last_col ) = localXPrimeX;
-            x_prime_y.rows( localSys.first_row, localSys.last_row ) = localXPrimeY.col( i );
             
             mLocalSystems.push_back(localSys);
             
@@ -288,6 +338,277 @@ void FieldFit::Fitter::AddConfiguration( Console &console, const Configuration &
             colOrigin += localXPrimeX.n_cols;
         }
     }
+    
+    //
+    // Insert the right hand sides, the matrices follow in AddMatrix or AddBlockSolver
+    //
+    
+    x_prime_y.zeros( rowOrigin );
+    
+    for ( const LocalSystem &localSys : mLocalSystems )
+    {
+        if ( localSys.last_row + 1 > localSys.first_row )
+        {
+            x_prime_y.rows( localSys.first_row, localSys.last_row ) = localSys.sourceSystem->PotentialMatrix().col( localSys.collectionIndex );
+        }
+    }
+}
+
+void FieldFit::Fitter::AddMatrix( Console &console )
+{
+    //
+    // Plan the bordered system, so that it is allocated once
+    //
+    
+    const size_t numColumns = x_prime_y.n_rows;
+    const size_t size = numColumns + mInternalConstraints.size();
+    
+    size_t nonZeros = 0;
+    
+    for ( const LocalSystem &localSys : mLocalSystems )
+    {
+        nonZeros += localSys.sourceSystem->GetLocalXPrimeX().n_elem;
+    }
+    
+    // at most, the restraints mostly land within the blocks
+    for ( const InternalConstraint &constr : mInternalRestraints )
+    {
+        nonZeros += constr.columns.size() * constr.columns.size();
+    }
+    
+    for ( const InternalConstraint &constr : mInternalConstraints )
+    {
+        nonZeros += 2 * constr.columns.size();
+    }
+    
+    console.Warn( Message( "", "Fitter::AddMatrix", "Planned normal equations: " + Util::ToString( numColumns ) + " parameters, " + 
+                           Util::ToString( mInternalConstraints.size() ) + " constraints, " + Util::ToString( size ) + " x " + 
+                           Util::ToString( size ) + " (MB): " + Util::ToString( fit_assembly::Bytes( size, nonZeros ) / F64( 1 << 20 ) ) ) );
+    
+    // dense entries are written in place, sparse ones are collected and compressed at once in Finish
+    fit_assembly assembly( x_prime_x, size, nonZeros );
+    
+    //
+    // Insert the coefficient matrices
+    //
+    
+    for ( const LocalSystem &localSys : mLocalSystems )
+    {
+        assembly.AddBlock( localSys.first_col, localSys.sourceSystem->GetLocalXPrimeX() );
+    }
+    
+    //
+    // Add restraints
+    //
+    
+    for ( const InternalConstraint &constr : mInternalRestraints )
+    {
+        const F64 sqrt_fc = std::sqrt( constr.fconst );
+        
+        for ( size_t i = 0; i < constr.columns.size(); ++i )
+        {
+            const U32 col_i = constr.columns[i];
+            
+            for ( size_t j = 0; j < constr.columns.size(); ++j )
+            {
+                const U32 col_j = constr.columns[j];
+                
+                assembly.Add( col_i, col_j, constr.coefficients[i] * sqrt_fc *
+                                            constr.coefficients[j] * sqrt_fc );
+                x_prime_y[ col_i ] += constr.reference / sqrt_fc;
+            }
+        }
+    }
+    
+    //
+    // Add contraints to the system
+    //
+    
+    size_t row = numColumns;
+    x_prime_y.resize( size, 1 );
+    
+    for ( const InternalConstraint &constr : mInternalConstraints )
+    {
+        for ( U32 c=0; c < constr.columns.size(); ++c )
+        {
+            assembly.Add( row, constr.columns[c], constr.coefficients[c] );
+            assembly.Add( constr.columns[c], row, constr.coefficients[c] );
+        }
+        
+        x_prime_y[row] = constr.reference;
+        
+        row++;
+    }
+    
+    assembly.Finish();
+}
+
+bool FieldFit::Fitter::AddBlockSolver( Console &console, ThreadPool &pool )
+{
+    for ( const InternalConstraint &constr : mInternalRestraints )
+    {
+        for ( U32 col : constr.columns )
+        {
+            if ( FindLocalSystem( col ) != FindLocalSystem( constr.columns[0] ) )
+            {
+                return false;
+            }
+        }
+    }
+    
+    std::vector< arma::mat > blocks;
+    blocks.reserve( mLocalSystems.size() );
+    
+    for ( const LocalSystem &localSys : mLocalSystems )
+    {
+        blocks.push_back( localSys.sourceSystem->GetLocalXPrimeX() );
+    }
+    
+    // only kept once the blocks turn out positive definite
+    arma::vec rhs = x_prime_y;
+    
+    //
+    // Add restraints to their blocks
+    //
+    
+    for ( const InternalConstraint &constr : mInternalRestraints )
+    {
+        const F64 sqrt_fc = std::sqrt( constr.fconst );
+        
+        for ( size_t i = 0; i < constr.columns.size(); ++i )
+        {
+            const U32 col_i = constr.columns[i];
+            const size_t l = FindLocalSystem( col_i );
+            const size_t first = mLocalSystems[l].first_col;
+            
+            for ( size_t j = 0; j < constr.columns.size(); ++j )
+            {
+                const U32 col_j = constr.columns[j];
+                
+                blocks[l]( col_i - first, col_j - first ) += constr.coefficients[i] * sqrt_fc *
+                                                             constr.coefficients[j] * sqrt_fc;
+                rhs[ col_i ] += constr.reference / sqrt_fc;
+            }
+        }
+    }
+    
+    //
+    // The constraints border the blocks, a row each
+    //
+    
+    size_t numCoefficients = 0;
+    
+    for ( const InternalConstraint &constr : mInternalConstraints )
+    {
+        numCoefficients += constr.columns.size();
+    }
+    
+    arma::umat locations( 2, numCoefficients );
+    arma::vec values( numCoefficients );
+    
+    size_t row = rhs.n_rows;
+    size_t index = 0;
+    rhs.resize( rhs.n_rows + mInternalConstraints.size(), 1 );
+    
+    for ( const InternalConstraint &constr : mInternalConstraints )
+    {
+        for ( U32 c=0; c < constr.columns.size(); ++c, ++index )
+        {
+            locations( 0, index ) = row - x_prime_y.n_rows;
+            locations( 1, index ) = constr.columns[c];
+            values[ index ] = constr.coefficients[c];
+        }
+        
+        rhs[row] = constr.reference;
+        
+        row++;
+    }
+    
+    const arma::sp_mat border( locations, values, mInternalConstraints.size(), x_prime_y.n_rows );
+    std::unique_ptr< BlockSolver > solver( new BlockSolver( std::move( blocks ), border, pool ) );
+    
+    if ( !solver->Factor() )
+    {
+        return false;
+    }
+    
+    console.Warn( Message( "", "Fitter::Fit", "Block solver: " + Util::ToString( solver->NumBlocks() ) + " blocks in " + 
+                           Util::ToString( solver->NumFactorizations() ) + " factorizations, " + 
+                           Util::ToString( mInternalConstraints.size() ) + " constraints" ) );
+    
+    mBlockSolver = std::move( solver );
+    x_prime_y = rhs;
+    
+    return true;
+}
+
+size_t FieldFit::Fitter::FindLocalSystem( size_t column ) const
+{
+    // the last local system that starts at or before the column
+    const auto it = std::upper_bound( mLocalSystems.begin(), mLocalSystems.end(), column, []( size_t col, const LocalSystem &localSys )
+    {
+        return col < localSys.first_col;
+    } );
+    
+    return it - mLocalSystems.begin() - 1;
+}
+
+size_t FieldFit::Fitter::SystemEnd( size_t first ) const
+{
+    size_t last = first;
+    
+    while ( last < mLocalSystems.size() && mLocalSystems[last].sourceSystem == mLocalSystems[first].sourceSystem )
+    {
+        ++last;
+    }
+    
+    return last;
+}
+
+arma::mat FieldFit::Fitter::SystemCoefficients( size_t first, size_t last ) const
+{
+    const System *sys = mLocalSystems[first].sourceSystem;
+    
+    arma::mat coefficients = arma::zeros( sys->NumColumns(), sys->PotentialMatrix().n_cols );
+    
+    // a system without columns has no rows in the solution either
+    if ( coefficients.n_rows == 0 )
+    {
+        return coefficients;
+    }
+    
+    for ( size_t l = first; l < last; ++l )
+    {
+        const LocalSystem &localSys = mLocalSystems[l];
+        coefficients.col( localSys.collectionIndex ) = mSolution.rows( localSys.first_row, localSys.last_row );
+    }
+    
+    return coefficients;
+}
+
+arma::vec FieldFit::Fitter::Solve( const arma::vec &rhs ) const
+{
+    if ( mBlockSolver )
+    {
+        return mBlockSolver->Solve( rhs );
+    }
+    
+    if ( mFactorization )
+    {
+        return mFactorization->Solve( rhs );
+    }
+    
+    return FIELDFIT_SOLVE( x_prime_x, rhs );
+}
+
+arma::vec FieldFit::Fitter::Multiply( const arma::vec &solution ) const
+{
+    if ( mBlockSolver )
+    {
+        return mBlockSolver->Multiply( solution );
+    }
+    
+    return x_prime_x * solution;
 }
 
 void FieldFit::Fitter::AddConstraints( Console &console, const Constraints &constraints )
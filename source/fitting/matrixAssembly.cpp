@@ -0,0 +1,79 @@
+#include "fitting/matrixAssembly.h"
+
+FieldFit::DenseAssembly::DenseAssembly( arma::mat &matrix, size_t size, size_t /*nonZeros*/ ) :
+    mMatrix( matrix )
+{
+    mMatrix.zeros( size, size );
+}
+
+size_t FieldFit::DenseAssembly::Bytes( size_t size, size_t /*nonZeros*/ )
+{
+    return size * size * sizeof( F64 );
+}
+
+void FieldFit::DenseAssembly::AddBlock( size_t first, const arma::mat &block )
+{
+    if ( block.n_elem > 0 )
+    {
+        mMatrix.submat( first, first, first + block.n_rows - 1, first + block.n_cols - 1 ) += block;
+    }
+}
+
+void FieldFit::DenseAssembly::Add( size_t row, size_t col, F64 value )
+{
+    mMatrix( row, col ) += value;
+}
+
+void FieldFit::DenseAssembly::Finish()
+{
+
+}
+
+FieldFit::SparseAssembly::SparseAssembly( arma::sp_mat &matrix, size_t size, size_t nonZeros ) :
+    mMatrix( matrix ), mSize( size )
+{
+    mRows.reserve( nonZeros );
+    mCols.reserve( nonZeros );
+    mValues.reserve( nonZeros );
+}
+
+size_t FieldFit::SparseAssembly::Bytes( size_t size, size_t nonZeros )
+{
+    return nonZeros * ( sizeof( F64 ) + sizeof( arma::uword ) ) + ( size + 1 ) * sizeof( arma::uword );
+}
+
+void FieldFit::SparseAssembly::AddBlock( size_t first, const arma::mat &block )
+{
+    for ( size_t c=0; c < block.n_cols; ++c )
+    {
+        for ( size_t r=0; r < block.n_rows; ++r )
+        {
+            Add( first + r, first + c, block( r, c ) );
+        }
+    }
+}
+
+void FieldFit::SparseAssembly::Add( size_t row, size_t col, F64 value )
+{
+    mRows.push_back( row );
+    mCols.push_back( col );
+    mValues.push_back( value );
+}
+
+void FieldFit::SparseAssembly::Finish()
+{
+    arma::umat locations( 2, mValues.size() );
+
+    for ( size_t i=0; i < mValues.size(); ++i )
+    {
+        locations( 0, i ) = mRows[i];
+        locations( 1, i ) = mCols[i];
+    }
+
+    // sorted into columns once, zeros are dropped and duplicates summed
+    mMatrix = arma::sp_mat( true, locations, arma::vec( mValues ), mSize, mSize );
+
+    mRows.clear();
+    mCols.clear();
+    mValues.clear();
+}
@@ -0,0 +1,309 @@
+#include "fitting/permTree.h"
+#include "fitting/delcomp.h"
+
+#include "common/exception.h"
+#include "common/util.h"
+
+#include <cmath>
+#include <utility>
+#include <algorithm>
+
+namespace
+{
+    using FieldFit::PermMultipole;
+
+    // nodes with fewer multipoles are summed directly
+    const size_t gLeafSize = 32;
+
+    // coincident multipoles would otherwise split forever
+    const U32 gMaxDepth = 20;
+
+    // neighbouring grid points that share a traversal
+    const size_t gBatchPoints = 64;
+
+    // bits per coordinate of the Morton keys
+    const U32 gMortonBits = 21;
+
+    // spreads the lower 21 bits of v over every third bit
+    U64 SpreadBits( U64 v )
+    {
+        v &= 0x1fffff;
+        v = ( v | v << 32 ) & 0x1f00000000ffff;
+        v = ( v | v << 16 ) & 0x1f0000ff0000ff;
+        v = ( v | v << 8 )  & 0x100f00f00f00f00f;
+        v = ( v | v << 4 )  & 0x10c30c30c30c30c3;
+        v = ( v | v << 2 )  & 0x1249249249249249;
+
+        return v;
+    }
+
+    // 0 to 7, one bit per axis that lies above the centre
+    U32 Octant( const PermMultipole &m, const F64 centre[3] )
+    {
+        return ( m.x > centre[0] ? 1 : 0 ) | ( m.y > centre[1] ? 2 : 0 ) | ( m.z > centre[2] ? 4 : 0 );
+    }
+}
+
+FieldFit::PermTree::PermTree( const std::vector< PermMultipole > &multipoles, F64 theta ) :
+    mMultipoles( multipoles ), mTheta( theta )
+{
+    if ( !( theta > 0.0 && theta < 1.0 ) )
+    {
+        throw ArgException( "FieldFit", "PermTree", "The opening angle of the treecode should lie between 0 and 1, got "+Util::ToString( theta ) );
+    }
+
+    if ( mMultipoles.empty() )
+    {
+        return;
+    }
+
+    F64 lower[3] = { mMultipoles[0].x, mMultipoles[0].y, mMultipoles[0].z };
+    F64 upper[3] = { lower[0], lower[1], lower[2] };
+
+    for ( const PermMultipole &m : mMultipoles )
+    {
+        lower[0] = std::min( lower[0], m.x ); upper[0] = std::max( upper[0], m.x );
+        lower[1] = std::min( lower[1], m.y ); upper[1] = std::max( upper[1], m.y );
+        lower[2] = std::min( lower[2], m.z ); upper[2] = std::max( upper[2], m.z );
+    }
+
+    Node root = {};
+
+    for ( U32 d=0; d < 3; ++d )
+    {
+        root.centre[d] = 0.5 * ( lower[d] + upper[d] );
+    }
+
+    root.begin = 0;
+    root.end = mMultipoles.size();
+
+    mNodes.push_back( root );
+
+    Split( 0, 0.5 * std::max( { upper[0] - lower[0], upper[1] - lower[1], upper[2] - lower[2] } ), 0 );
+}
+
+void FieldFit::PermTree::Evaluate( const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t numPoints, F64 *field ) const
+{
+    if ( numPoints == 0 || mNodes.empty() )
+    {
+        return;
+    }
+
+    F64 lower[3] = { gridX[0], gridY[0], gridZ[0] };
+    F64 extent = 0.0;
+
+    for ( size_t i=0; i < numPoints; ++i )
+    {
+        lower[0] = std::min( lower[0], gridX[i] );
+        lower[1] = std::min( lower[1], gridY[i] );
+        lower[2] = std::min( lower[2], gridZ[i] );
+    }
+
+    for ( size_t i=0; i < numPoints; ++i )
+    {
+        extent = std::max( { extent, gridX[i] - lower[0], gridY[i] - lower[1], gridZ[i] - lower[2] } );
+    }
+
+    // the points are visited along a Morton curve, so a batch of consecutive points lies close together
+    const F64 scale = extent > 0.0 ? ( ( 1 << gMortonBits ) - 1 ) / extent : 0.0;
+
+    std::vector< std::pair< U64, size_t > > order( numPoints );
+
+    for ( size_t i=0; i < numPoints; ++i )
+    {
+        const U64 ix = static_cast< U64 >( ( gridX[i] - lower[0] ) * scale );
+        const U64 iy = static_cast< U64 >( ( gridY[i] - lower[1] ) * scale );
+        const U64 iz = static_cast< U64 >( ( gridZ[i] - lower[2] ) * scale );
+
+        order[i] = std::make_pair( SpreadBits( ix ) | SpreadBits( iy ) << 1 | SpreadBits( iz ) << 2, i );
+    }
+
+    std::sort( order.begin(), order.end() );
+
+    std::vector< F64 > sortedX( numPoints ), sortedY( numPoints ), sortedZ( numPoints ), sortedField( numPoints, 0.0 );
+
+    for ( size_t k=0; k < numPoints; ++k )
+    {
+        sortedX[k] = gridX[ order[k].second ];
+        sortedY[k] = gridY[ order[k].second ];
+        sortedZ[k] = gridZ[ order[k].second ];
+    }
+
+    std::vector< size_t > stack;
+
+    for ( size_t begin=0; begin < numPoints; begin += gBatchPoints )
+    {
+        const size_t size = std::min( gBatchPoints, numPoints - begin );
+
+        EvaluateBatch( &sortedX[ begin ], &sortedY[ begin ], &sortedZ[ begin ], size, &sortedField[ begin ], stack );
+    }
+
+    for ( size_t k=0; k < numPoints; ++k )
+    {
+        field[ order[k].second ] += sortedField[k];
+    }
+}
+
+F64 FieldFit::PermTree::GetTheta() const
+{
+    return mTheta;
+}
+
+void FieldFit::PermTree::Split( size_t node, F64 halfWidth, U32 depth )
+{
+    SetMoments( mNodes[ node ] );
+
+    const size_t begin = mNodes[ node ].begin, end = mNodes[ node ].end;
+    const F64 centre[3] = { mNodes[ node ].centre[0], mNodes[ node ].centre[1], mNodes[ node ].centre[2] };
+
+    if ( end - begin <= gLeafSize || depth == gMaxDepth )
+    {
+        return;
+    }
+
+    std::stable_sort( mMultipoles.begin() + begin, mMultipoles.begin() + end, [&centre]( const PermMultipole &a, const PermMultipole &b )
+    {
+        return Octant( a, centre ) < Octant( b, centre );
+    } );
+
+    // the children are stored next to each other, before any of them is split
+    const size_t firstChild = mNodes.size();
+
+    for ( size_t first = begin; first < end; )
+    {
+        const U32 octant = Octant( mMultipoles[ first ], centre );
+
+        size_t last = first;
+
+        while ( last < end && Octant( mMultipoles[ last ], centre ) == octant )
+        {
+            ++last;
+        }
+
+        Node child = {};
+
+        child.centre[0] = centre[0] + ( octant & 1 ? 0.5 : -0.5 ) * halfWidth;
+        child.centre[1] = centre[1] + ( octant & 2 ? 0.5 : -0.5 ) * halfWidth;
+        child.centre[2] = centre[2] + ( octant & 4 ? 0.5 : -0.5 ) * halfWidth;
+        child.begin = first;
+        child.end = last;
+
+        mNodes.push_back( child );
+
+        first = last;
+    }
+
+    const size_t numChildren = mNodes.size() - firstChild;
+
+    mNodes[ node ].firstChild = firstChild;
+    mNodes[ node ].numChildren = numChildren;
+
+    for ( size_t c=0; c < numChildren; ++c )
+    {
+        Split( firstChild + c, 0.5 * halfWidth, depth + 1 );
+    }
+}
+
+void FieldFit::PermTree::SetMoments( Node &node ) const
+{
+    // second moments, made traceless at the end
+    F64 m[6] = {};
+
+    for ( size_t i = node.begin; i < node.end; ++i )
+    {
+        const PermMultipole &pm = mMultipoles[i];
+
+        const F64 d[3] = { pm.x - node.centre[0], pm.y - node.centre[1], pm.z - node.centre[2] };
+        const F64 mu[3] = { pm.dipoleX, pm.dipoleY, pm.dipoleZ };
+
+        node.radius = std::max( node.radius, std::sqrt( d[0] * d[0] + d[1] * d[1] + d[2] * d[2] ) );
+        node.charge += pm.charge;
+
+        for ( U32 a=0; a < 3; ++a )
+        {
+            node.dipole[a] += mu[a] + pm.charge * d[a];
+        }
+
+        // q d d' + mu d' + d mu'
+        m[0] += pm.charge * d[0] * d[0] + 2.0 * mu[0] * d[0];
+        m[1] += pm.charge * d[1] * d[1] + 2.0 * mu[1] * d[1];
+        m[2] += pm.charge * d[2] * d[2] + 2.0 * mu[2] * d[2];
+        m[3] += pm.charge * d[0] * d[1] + mu[0] * d[1] + d[0] * mu[1];
+        m[4] += pm.charge * d[0] * d[2] + mu[0] * d[2] + d[0] * mu[2];
+        m[5] += pm.charge * d[1] * d[2] + mu[1] * d[2] + d[1] * mu[2];
+    }
+
+    const F64 trace = m[0] + m[1] + m[2];
+
+    for ( U32 a=0; a < 6; ++a )
+    {
+        node.quadrupole[a] = 3.0 * m[a] - ( a < 3 ? trace : 0.0 );
+    }
+}
+
+void FieldFit::PermTree::EvaluateBatch( const F64 *gridX, const F64 *gridY, const F64 *gridZ, size_t numPoints, F64 *field,
+                                        std::vector< size_t > &stack ) const
+{
+    F64 lower[3] = { gridX[0], gridY[0], gridZ[0] };
+    F64 upper[3] = { lower[0], lower[1], lower[2] };
+
+    for ( size_t i=0; i < numPoints; ++i )
+    {
+        lower[0] = std::min( lower[0], gridX[i] ); upper[0] = std::max( upper[0], gridX[i] );
+        lower[1] = std::min( lower[1], gridY[i] ); upper[1] = std::max( upper[1], gridY[i] );
+        lower[2] = std::min( lower[2], gridZ[i] ); upper[2] = std::max( upper[2], gridZ[i] );
+    }
+
+    const F64 centre[3] = { 0.5 * ( lower[0] + upper[0] ), 0.5 * ( lower[1] + upper[1] ), 0.5 * ( lower[2] + upper[2] ) };
+
+    F64 radius = 0.0;
+
+    for ( size_t i=0; i < numPoints; ++i )
+    {
+        const F64 dx = gridX[i] - centre[0], dy = gridY[i] - centre[1], dz = gridZ[i] - centre[2];
+
+        radius = std::max( radius, std::sqrt( dx * dx + dy * dy + dz * dz ) );
+    }
+
+    stack.assign( 1, 0 );
+
+    while ( !stack.empty() )
+    {
+        const Node &node = mNodes[ stack.back() ];
+        stack.pop_back();
+
+        const F64 cx = node.centre[0] - centre[0], cy = node.centre[1] - centre[1], cz = node.centre[2] - centre[2];
+        const F64 distance = std::sqrt( cx * cx + cy * cy + cz * cz );
+
+        if ( node.radius + radius < mTheta * distance )
+        {
+            const F64 *q = node.quadrupole;
+
+            for ( size_t i=0; i < numPoints; ++i )
+            {
+                const F64 dx = gridX[i] - node.centre[0], dy = gridY[i] - node.centre[1], dz = gridZ[i] - node.centre[2];
+
+                const F64 invR = 1.0 / std::sqrt( dx * dx + dy * dy + dz * dz );
+                const F64 invR2 = invR * invR;
+                const F64 invR3 = invR2 * invR;
+                const F64 invR5 = invR3 * invR2;
+
+                const F64 dipole = node.dipole[0] * dx + node.dipole[1] * dy + node.dipole[2] * dz;
+                const F64 quadrupole = q[0] * dx * dx + q[1] * dy * dy + q[2] * dz * dz + 2.0 * ( q[3] * dx * dy + q[4] * dx * dz + q[5] * dy * dz );
+
+                field[i] += node.charge * invR + dipole * invR3 + 0.5 * quadrupole * invR5;
+            }
+        }
+        else if ( node.numChildren == 0 )
+        {
+            DelCompPermField( &mMultipoles[ node.begin ], node.end - node.begin, gridX, gridY, gridZ, numPoints, field );
+        }
+        else
+        {
+            for ( size_t c = node.numChildren; c > 0; --c )
+            {
+                stack.push_back( node.firstChild + c - 1 );
+            }
+        }
+    }
+}
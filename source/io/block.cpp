@@ -2,15 +2,24 @@
 
 #include <assert.h>
 
-FieldFit::Block::Block( const std::string & title, const std::vector< std::string > &buffer ) : mTitle( title )
+FieldFit::Block::Block( const std::string & title, std::vector< Token > &&buffer, const std::shared_ptr< const void > &source ) : 
+	mTitle( title ), mTokens( std::move( buffer ) ), mSource( source ), mBodyBegin( nullptr ), mBodyEnd( nullptr ), 
+	mPayload( nullptr ), mRows( 0 ), mCols( 0 )
+{
+}
+
+FieldFit::Block::Block( const std::string & title, std::vector< Token > &&buffer, const std::shared_ptr< const void > &source,
+                        const char *bodyBegin, const char *bodyEnd, const std::string &file ) : 
+	mTitle( title ), mTokens( std::move( buffer ) ), mSource( source ), mBodyBegin( bodyBegin ), mBodyEnd( bodyEnd ), 
+	mFile( file ), mPayload( nullptr ), mRows( 0 ), mCols( 0 )
+{
+}
+
+FieldFit::Block::Block( const std::string & title, std::vector< Token > &&buffer, const std::shared_ptr< const void > &source,
+                        const F64 *payload, size_t rows, size_t cols ) : 
+	mTitle( title ), mTokens( std::move( buffer ) ), mSource( source ), mBodyBegin( nullptr ), mBodyEnd( nullptr ), 
+	mPayload( payload ), mRows( rows ), mCols( cols )
 {
-	mTokens.reserve( buffer.size() );
-	
-	for ( std::vector< std::string >::const_iterator it = buffer.begin(), itend = buffer.end();
-		it != itend; ++it )
-	{
-		mTokens.push_back( Token( *it ) );
-	}
 }
 
 void FieldFit::Block::Debug()
@@ -23,6 +32,11 @@ void FieldFit::Block::Debug()
 		it->Debug();	
 	}
 	
+	if ( mBodyBegin != mBodyEnd )
+	{
+		std::cout.write( mBodyBegin, mBodyEnd - mBodyBegin ) << std::endl;
+	}
+	
 	std::cout << "[END]" << std::endl;
 }
 
@@ -51,4 +65,43 @@ const FieldFit::Block::Token* FieldFit::Block::GetToken( U32 index ) const
 	assert ( index < mTokens.size() );
 	
 	return &mTokens[ index ];
-}
\ No newline at end of file
+}
+
+const char *FieldFit::Block::BodyBegin() const
+{
+	return mBodyBegin;
+}
+
+const char *FieldFit::Block::BodyEnd() const
+{
+	return mBodyEnd;
+}
+
+bool FieldFit::Block::HasPayload() const
+{
+	return mPayload != nullptr;
+}
+
+const F64 *FieldFit::Block::GetPayload() const
+{
+	return mPayload;
+}
+
+size_t FieldFit::Block::PayloadRows() const
+{
+	return mRows;
+}
+
+size_t FieldFit::Block::PayloadCols() const
+{
+	return mCols;
+}
+
+const std::shared_ptr< const void > &FieldFit::Block::GetSource() const
+{
+	return mSource;
+}
+const std::string &FieldFit::Block::GetFile() const
+{
+	return mFile;
+}
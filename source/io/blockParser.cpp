@@ -1,136 +1,619 @@
 #include "io/blockParser.h"
 #include "io/tokenizer.h"
 #include "io/block.h"
+#include "io/mappedFile.h"
+#include "io/binaryFormat.h"
 
 #include "common/exception.h"
+#include "common/threadPool.h"
 #include "common/util.h"
 
-#include <fstream>
+#include <chrono>
+#include <memory>
+#include <algorithm>
+#include <ctype.h>
+#include <cstring>
 #include <assert.h>
 #include <iostream>
 
 using namespace FieldFit;
+using namespace std::chrono;
 
-FieldFit::BlockParser::BlockParser( const std::vector< std::string > &files ) 
+namespace
 {
-	for( U32 i=0; i < files.size(); ++i )
+	inline bool IsDelimiter( const char c )
 	{
-		ParseFile( files[i] );
+		return c == ' ' || c == '\t' || c == ';';
 	}
+	
+	/*
+	**	Blocks that are read selectively ( column selection, only alpha sites ) or in parallel are not
+	**	tokenized beyond their header, so their readers can skip the unused values without materializing
+	**	them and split the rest over several threads
+	*/
+	size_t DeferredHeaderSize( const std::string &title )
+	{
+		if ( title == "FIELD" || title == "EFIELD" )
+		{
+			return 3;
+		}
+		
+		if ( title == "GRID" )
+		{
+			return 2;
+		}
+		
+		return 0;
+	}
+}
+
+namespace
+{
+	// trims the next line of [ it, end ), it is moved to the start of the line after
+	void NextLine( const char *&it, const char *end, const char *&begin, const char *&last )
+	{
+		const char *lineEnd = static_cast< const char* >( memchr( it, '\n', end - it ) );
+		
+		if ( !lineEnd )
+		{
+			lineEnd = end;
+		}
+		
+		begin = it;
+		last = lineEnd;
+		
+		while ( begin < last && isspace( *begin ) )
+		{
+			++begin;
+		}
+		
+		while ( last > begin && isspace( *( last - 1 ) ) )
+		{
+			--last;
+		}
+		
+		it = lineEnd + 1;
+	}
+	
+	bool HasToken( const char *begin, const char *end )
+	{
+		while ( begin < end && IsDelimiter( *begin ) )
+		{
+			++begin;
+		}
+		
+		return begin < end;
+	}
+	
+	// start of the last token of the trimmed line [ begin, last )
+	const char *LastToken( const char *begin, const char *last )
+	{
+		const char *lastToken = last;
+		
+		while ( lastToken > begin && !IsDelimiter( *( lastToken - 1 ) ) )
+		{
+			--lastToken;
+		}
+		
+		return lastToken;
+	}
+}
+
+namespace
+{
+	// files indexed ahead of the merged ones per thread, more would only queue before the readers' work
+	const size_t gIndexAhead = 2;
+}
+
+FieldFit::BlockParser::BlockParser( const std::vector< std::string > &files ) :
+	mFiles( files ), mPool( nullptr ), mNumMerged( 0 )
+{
+	ThreadPool serial( 1 );
+	
+	mPool = &serial;
+	MergeAll();
+	mPool = nullptr;
+}
+
+FieldFit::BlockParser::BlockParser( const std::vector< std::string > &files, ThreadPool &pool ) :
+	mFiles( files ), mPool( &pool ), mNumMerged( 0 )
+{
+	IndexAhead();
+}
+
+void FieldFit::BlockParser::IndexAhead()
+{
+	// a pool without workers would index the whole file within Submit, before anything can be merged
+	const bool ownThread = mPool->NumThreads() == 1;
+	const size_t ahead = ownThread ? 1 : gIndexAhead * mPool->NumThreads();
+	
+	while ( mIndexing.size() < ahead && mNumMerged + mIndexing.size() < mFiles.size() )
+	{
+		const std::string file = mFiles[ mNumMerged + mIndexing.size() ];
+		
+		std::shared_ptr< Indexing > indexing = std::make_shared< Indexing >();
+		indexing->done = false;
+		indexing->seconds = 0.0;
+		
+		auto task = [file, indexing]()
+		{
+			auto t0 = high_resolution_clock::now();
+			
+			try
+			{
+				IndexFile( file, *indexing );
+			}
+			catch ( ... )
+			{
+				indexing->error = std::current_exception();
+			}
+			
+			auto t1 = high_resolution_clock::now();
+			
+			{
+				std::lock_guard< std::mutex > lock( indexing->mutex );
+				
+				indexing->seconds = duration_cast< duration< F64 > >( t1 - t0 ).count();
+				indexing->done = true;
+			}
+			
+			indexing->condition.notify_all();
+		};
+		
+		mIndexing.push_back( std::make_pair( indexing, ownThread ? std::async( std::launch::async, task ) : mPool->Submit( task ) ) );
+	}
+}
+
+bool FieldFit::BlockParser::MergeNext()
+{
+	if ( mNumMerged == mFiles.size() )
+	{
+		return false;
+	}
+	
+	IndexAhead();
+	
+	Indexing &indexing = *mIndexing.front().first;
+	
+	IndexMap index;
+	bool done;
+	
+	{
+		// merging in input order keeps the block order, and thus the first error, identical to a serial run
+		std::unique_lock< std::mutex > lock( indexing.mutex );
+		mPool->Wait( lock, indexing.condition, [&indexing]() { return indexing.done || !indexing.index.empty(); } );
+		
+		index.swap( indexing.index );
+		done = indexing.done;
+	}
+	
+	Merge( index );
+	
+	mPartialFirstToken.clear();
+	
+	if ( !done )
+	{
+		// the blocks of a file lie in the order they were indexed
+		const std::string *title = nullptr;
+		const Entry *last = nullptr;
+		
+		for ( const auto &entries : index )
+		{
+			if ( !last || entries.second.back().begin > last->begin )
+			{
+				title = &entries.first;
+				last = &entries.second.back();
+			}
+		}
+		
+		mPartialFirstToken = FirstToken( *title, *last );
+		
+		return true;
+	}
+	
+	const std::exception_ptr error = indexing.error;
+	
+	mParseTimes.push_back( std::make_pair( mFiles[ mNumMerged++ ], indexing.seconds ) );
+	mIndexing.pop_front();
+	
+	if ( error )
+	{
+		std::rethrow_exception( error );
+	}
+	
+	IndexAhead();
+	
+	return true;
+}
+
+void FieldFit::BlockParser::MergeAll()
+{
+	while ( MergeNext() )
+	{
+	}
+}
+
+const std::string &FieldFit::BlockParser::GetPartialFirstToken() const
+{
+	return mPartialFirstToken;
+}
+
+size_t FieldFit::BlockParser::NumBlocks( const std::string &block ) const
+{
+	IndexMap::const_iterator it = mIndex.find( block );
+	
+	return it == mIndex.end() ? 0 : it->second.size();
+}
+	
+const BlockParser::Entry &FieldFit::BlockParser::GetEntry( const std::string &block, size_t index ) const
+{
+	IndexMap::const_iterator it = mIndex.find( block );
+	
+	if ( it == mIndex.end() || index >= it->second.size() )
+	{
+		throw ArgException( "BlockParser", "GetBlock", "block " + block + " number " + Util::ToString( index ) + " does not exist." );
+	}
+	
+	return it->second[ index ];
 }
 	
-const std::vector< Block > * FieldFit::BlockParser::GetBlockArray( const std::string &block ) const
+Block FieldFit::BlockParser::GetBlock( const std::string &block, size_t index ) const
 {
-	std::map< std::string, std::vector< Block > >::const_iterator it = mBlocks.find( block );
+	const Entry &entry = GetEntry( block, index );
 	
-	if ( it == mBlocks.end() )
+	return entry.binary ? ParseBinaryBlock( block, entry ) : ParseBlock( block, entry );
+}
+
+std::string FieldFit::BlockParser::GetFirstToken( const std::string &block, size_t index ) const
+{
+	return FirstToken( block, GetEntry( block, index ) );
+}
+
+std::string FieldFit::BlockParser::FirstToken( const std::string &title, const Entry &entry )
+{
+	if ( entry.binary )
 	{
-		return nullptr;
+		const Block binary = ParseBinaryBlock( title, entry );
+		
+		return binary.Size() > 0 ? binary.GetToken( 0 )->GetToken() : "";
 	}
 	
-	return &it->second;
+	const char *it = entry.begin, *end = entry.end;
+	
+	while ( it < end )
+	{
+		const char *begin, *last;
+		NextLine( it, end, begin, last );
+		
+		if ( begin == last || *begin == '#' )
+		{
+			continue;
+		}
+		
+		while ( begin < last && IsDelimiter( *begin ) )
+		{
+			++begin;
+		}
+		
+		const char *tokenEnd = begin;
+		
+		while ( tokenEnd < last && !IsDelimiter( *tokenEnd ) )
+		{
+			++tokenEnd;
+		}
+		
+		if ( begin < tokenEnd )
+		{
+			return std::string( begin, tokenEnd );
+		}
+	}
+	
+	return "";
 }
 
-const Block * FieldFit::BlockParser::GetBlock( const std::string &block ) const
+void FieldFit::BlockParser::Release( const std::string &block, size_t index ) const
 {
-    std::map< std::string, std::vector< Block > >::const_iterator it = mBlocks.find( block );
+	const Entry &entry = GetEntry( block, index );
+	
+	// binary payloads may still be referenced without a copy, text is always converted
+	if ( !entry.binary )
+	{
+		entry.file->Release( entry.begin, entry.end );
+	}
+}
+
+std::unique_ptr< const Block > FieldFit::BlockParser::GetBlock( const std::string &block ) const
+{
+    const size_t numBlocks = NumBlocks( block );
     
-    if ( it == mBlocks.end() )
+    if ( numBlocks == 0 )
     {
         return nullptr;
     }
     
-    const std::vector< Block > &blockArray = it->second;
-    
     // Now perform size test
-    if ( blockArray.size() != 1 )
+    if ( numBlocks != 1 )
     {
         throw ArgException( "BlockParser", "GetBlock", "A call to GetBlock suggests that only one block of requested type " + block +" should exist." );
     }
     
-    return blockArray.data();
+    return std::unique_ptr< const Block >( new Block( GetBlock( block, 0 ) ) );
 }
 
 void FieldFit::BlockParser::DeleteBlock( const std::string &block )
 {
-    std::map< std::string, std::vector< Block > >::const_iterator it = mBlocks.find( block );
+    IndexMap::iterator it = mIndex.find( block );
     
-    if ( it != mBlocks.end() )
+    if ( it != mIndex.end() )
     {
-        //std::cout << "ERASING " << block << std::endl;
-        mBlocks.erase(it);
+        for ( size_t i=0; i < it->second.size(); ++i )
+        {
+            Release( block, i );
+        }
+        
+        mIndex.erase( it );
     }
 }
 	
-void FieldFit::BlockParser::ParseFile( const std::string &file )
+void FieldFit::BlockParser::Publish( Indexing &indexing, const std::string &title, const Entry &entry )
 {
-	std::ifstream stream;
+	{
+		std::lock_guard< std::mutex > lock( indexing.mutex );
+		indexing.index[title].push_back( entry );
+	}
 	
-	stream.open( file.c_str(), std::ios::in );
+	indexing.condition.notify_all();
+}
+
+void FieldFit::BlockParser::IndexFile( const std::string &file, Indexing &indexing )
+{
+	// the blocks hold views into the mapping, so they share its ownership
+	std::shared_ptr< const MappedFile > mapped = std::make_shared< const MappedFile >( file );
 	
-	if ( !stream.is_open() )
+	if ( BinaryFormat::IsBinary( mapped->Data(), mapped->Available( sizeof( BinaryFormat::Header ) - 1 ) ) )
 	{
-        throw ArgException( "BlockParser", "GetBlock", "Unable to open file "+file+" !" );
+		IndexBinaryFile( mapped, indexing );
+		
 		return;
 	}
 	
-    std::string line, title = "";
-    Tokenizer tn;
-	while ( getline ( stream, line ) )
+	// a compressed input is indexed while it is still being decompressed
+	const char *data = mapped->Data();
+	const char *it = data, *end = data;
+	
+    std::string title = "";
+    const char *blockBegin = nullptr;
+    
+    // END only closes a block that has at least one other token, the same rule as Tokenizer::IsEnd
+    bool hasTokens = false;
+    
+	while ( it < ( end = data + mapped->Available( it - data ) ) )
     {
-    	line = Util::Trim( line );
-    	
-    	if ( line.size() > 0 )
+    	// a line is complete once its newline, or the end of the input, is available
+    	while ( !memchr( it, '\n', end - it ) )
     	{
-    		//test for comment
-    		if ( line[0] == '#' )
-    		{
-    			continue;	
-    		}
+    		const char *more = data + mapped->Available( end - data );
     		
-    		if ( title.size() == 0 )
+    		if ( more == end )
     		{
-    			title = line;
-    			
-    			continue;
+    			break;
     		}
     		
-    		tn.Tokenize( line, " \t;" );
+    		end = more;
+    	}
+    	
+    	const char *begin, *last;
+    	NextLine( it, end, begin, last );
+    	
+    	//test for comment
+    	if ( begin == last || *begin == '#' )
+    	{
+    		continue;	
+    	}
+    	
+    	if ( title.size() == 0 )
+    	{
+    		title.assign( begin, last );
+    		blockBegin = std::min( it, end );
+    		hasTokens = false;
     		
-    		if ( tn.IsEnd() )
+    		continue;
+    	}
+    	
+    	const char *lastToken = LastToken( begin, last );
+    	
+    	if ( last - lastToken == 3 && memcmp( lastToken, "END", 3 ) == 0 )
+    	{
+    		if ( hasTokens || HasToken( begin, lastToken ) )
     		{
-                std::map< std::string, std::vector< Block > >::const_iterator it = mBlocks.find( title );
-                
-                if ( it == mBlocks.end() )
-                {
-                    mBlocks.insert( std::pair< std::string, std::vector< Block > >( title, std::vector< Block >() ) );
-                }
-                
-                mBlocks[title].push_back( Block( title, tn.GetBuffer() ) );
+    			Entry entry = { mapped, blockBegin, std::min( it, end ), false };
+    			Publish( indexing, title, entry );
     			
-    			tn.Empty();
     			title = "";
+    			
+    			continue;
     		}
     	}
+    	
+    	hasTokens = hasTokens || HasToken( begin, last );
     }
+}
+
+Block FieldFit::BlockParser::ParseBlock( const std::string &title, const Entry &entry )
+{
+	const char *it = entry.begin, *end = entry.end;
 	
-    // final flush
-    if ( tn.IsEnd() && tn.Size() > 0 && title.size() > 0 )
+    Tokenizer tn( " \t;" );
+    
+    // for deferred blocks, the number of header tokens and the start of the untokenized body
+    const size_t headerSize = DeferredHeaderSize( title );
+    const char *bodyBegin = nullptr;
+    
+	while ( it < end )
     {
-        std::map< std::string, std::vector< Block > >::const_iterator it = mBlocks.find( title );
-        
-        if ( it == mBlocks.end() )
-        {
-            mBlocks.insert( std::pair< std::string, std::vector< Block > >( title, std::vector< Block >() ) );
-        }
-        
-        mBlocks[title].push_back( Block( title, tn.GetBuffer() ) );
+    	const char *begin, *last;
+    	NextLine( it, end, begin, last );
+    	
+    	//test for comment
+    	if ( begin == last || *begin == '#' )
+    	{
+    		continue;	
+    	}
+    	
+    	if ( bodyBegin )
+    	{
+    		// inside the body we only look for the closing END
+    		const char *lastToken = LastToken( begin, last );
+    		
+    		if ( last - lastToken == 3 && memcmp( lastToken, "END", 3 ) == 0 )
+    		{
+    			return Block( title, std::move( tn.GetBuffer() ), entry.file, bodyBegin, lastToken, entry.file->GetName() );
+    		}
+    		
+    		continue;
+    	}
+    	
+    	tn.Tokenize( begin, last );
+    	
+    	const bool isEnd = tn.IsEnd();
+    	std::vector< Block::Token > &buffer = tn.GetBuffer();
+    	
+    	if ( headerSize > 0 && buffer.size() >= headerSize )
+    	{
+    		// the header is complete, everything after it is left to the reader
+    		const Block::Token &lastHeader = buffer[ headerSize - 1 ];
+    		bodyBegin = lastHeader.Data() + lastHeader.Length();
+    		
+    		const char *bodyEnd = isEnd ? buffer.back().Data() + buffer.back().Length() : last;
+    		
+    		buffer.erase( buffer.begin() + headerSize, buffer.end() );
+    		
+    		if ( isEnd )
+    		{
+    			return Block( title, std::move( buffer ), entry.file, bodyBegin, bodyEnd, entry.file->GetName() );
+    		}
+    	}
+    	else if ( isEnd )
+    	{
+            return Block( title, std::move( buffer ), entry.file );
+    	}
     }
     
-	stream.close();
+    // the index only records blocks that are closed by an END
+    throw ArgException( "BlockParser", "ParseBlock", "block [" + title + "] in file " + entry.file->GetName() + " changed since it was indexed" );
+}
+
+void FieldFit::BlockParser::IndexBinaryFile( const std::shared_ptr< const MappedFile > &mapped, Indexing &indexing )
+{
+	const char *data = mapped->Data();
+	const U64 size = mapped->Size();
+	const std::string &file = mapped->GetName();
+	
+	BinaryFormat::Header header;
+	memcpy( &header, data, sizeof( header ) );
+	
+	if ( header.byteOrder != BinaryFormat::ByteOrder )
+	{
+		throw ArgException( "BlockParser", "ParseBinaryFile", "binary file "+file+" was written with a different byte order" );
+	}
+	
+	if ( header.version != BinaryFormat::Version )
+	{
+		throw ArgException( "BlockParser", "ParseBinaryFile", "binary file "+file+" has unsupported version "+Util::ToString( header.version ) );
+	}
+	
+	U64 offset = sizeof( header );
+	
+	for ( U64 r=0; r < header.numRecords; ++r )
+	{
+		BinaryFormat::Record record;
+		
+		if ( offset % BinaryFormat::Alignment != 0 || offset + sizeof( record ) > size )
+		{
+			throw ArgException( "BlockParser", "ParseBinaryFile", "binary file "+file+" is truncated or corrupt" );
+		}
+		
+		memcpy( &record, data + offset, sizeof( record ) );
+		
+		const std::string title( record.title, strnlen( record.title, sizeof( record.title ) ) );
+		
+		// a corrupt header could wrap the payload size around
+		if ( record.rows > size / sizeof( F64 ) / std::max< U64 >( record.cols, 1 ) )
+		{
+			throw ArgException( "BlockParser", "ParseBinaryFile", "binary file "+file+" has a corrupt record "+title );
+		}
+		
+		const U64 payloadSize = record.rows * record.cols * sizeof( F64 );
+		
+		if ( record.payloadOffset % BinaryFormat::Alignment != 0 || record.payloadOffset > size || 
+		     record.payloadOffset < offset + sizeof( record ) || payloadSize > size - record.payloadOffset || 
+		     record.nextOffset <= offset )
+		{
+			throw ArgException( "BlockParser", "ParseBinaryFile", "binary file "+file+" has a corrupt record "+title );
+		}
+		
+		Entry entry = { mapped, data + offset, data + record.payloadOffset, true };
+		Publish( indexing, title, entry );
+		
+		offset = record.nextOffset;
+	}
+}
+
+Block FieldFit::BlockParser::ParseBinaryBlock( const std::string &title, const Entry &entry )
+{
+	const std::string &file = entry.file->GetName();
+	
+	BinaryFormat::Record record;
+	memcpy( &record, entry.begin, sizeof( record ) );
+	
+	// the tokens lie between the record and its payload
+	const char *it = entry.begin + sizeof( record ), *end = entry.end;
+	
+	std::vector< Block::Token > tokens;
+	tokens.reserve( record.numTokens );
+	
+	for ( U64 t=0; t < record.numTokens; ++t )
+	{
+		U32 length;
+		
+		if ( end - it < static_cast< ptrdiff_t >( sizeof( length ) ) )
+		{
+			throw ArgException( "BlockParser", "ParseBinaryFile", "binary file "+file+" has a corrupt record "+title );
+		}
+		
+		memcpy( &length, it, sizeof( length ) );
+		it += sizeof( length );
+		
+		if ( static_cast< U64 >( end - it ) < length )
+		{
+			throw ArgException( "BlockParser", "ParseBinaryFile", "binary file "+file+" has a corrupt record "+title );
+		}
+		
+		tokens.push_back( Block::Token( it, length ) );
+		it += length;
+	}
+	
+	const F64 *payload = reinterpret_cast< const F64* >( end );
+	
+	return Block( title, std::move( tokens ), entry.file, payload, record.rows, record.cols );
+}
+
+void FieldFit::BlockParser::Merge( IndexMap &index )
+{
+	for ( auto it = index.begin(), itend = index.end(); it != itend; ++it )
+	{
+		std::vector< Entry > &entries = mIndex[ it->first ];
+		
+		entries.insert( entries.end(), it->second.begin(), it->second.end() );
+	}
+}
+
+const std::vector< std::pair< std::string, F64 > > &FieldFit::BlockParser::GetParseTimes() const
+{
+	return mParseTimes;
 }
 
 void FieldFit::BlockParser::Clear()
 {
-    mBlocks.clear();
+    mIndex.clear();
 }
\ No newline at end of file
@@ -10,27 +10,17 @@
 
 void FieldFit::ReadSumConstraintSet( const BlockParser &bp, const Units &units, Constraints &constr )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("SUMCONSTR");
-    
-    if ( blockArray )
-    {
-        for ( const Block &block : *blockArray )
-        { 
-            ReadSumConstraints(block, units, constr);            
-        }
+    for ( size_t i=0, numBlocks=bp.NumBlocks("SUMCONSTR"); i < numBlocks; ++i )
+    { 
+        ReadSumConstraints( bp.GetBlock( "SUMCONSTR", i ), units, constr );
     }
 }
 
 void FieldFit::ReadSymConstraintSet( const BlockParser &bp, const Units &units, Constraints &constr )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("SYMCONSTR");
-    
-    if ( blockArray )
-    {
-        for ( const Block &block : *blockArray )
-        { 
-            ReadSymConstraints(block, units, constr);            
-        }
+    for ( size_t i=0, numBlocks=bp.NumBlocks("SYMCONSTR"); i < numBlocks; ++i )
+    { 
+        ReadSymConstraints( bp.GetBlock( "SYMCONSTR", i ), units, constr );
     }
 }
          
@@ -41,7 +31,7 @@ void FieldFit::ReadSumConstraints( const Block &block, const Units &units, Const
         throw ArgException( "FieldFit", "ReadSumConstraints", "block [SUMCONSTR] was too small ( at least 1 argument expected ) !" );
     }
 
-    const U32 numConstr = block.GetToken( 0 )->GetValue< U32 >();
+    const U32 numConstr = block.GetValue< U32 >( 0 );
     
     U32 index = 1;
     for ( U32 i=0; i < numConstr; ++i )
@@ -51,7 +41,7 @@ void FieldFit::ReadSumConstraints( const Block &block, const Units &units, Const
             throw ArgException( "FieldFit", "ReadSumConstraints", "block [SUMCONSTR] did not have the right amount of arguments based on the size indicator!" );
         }
         
-        const U32 numItems = block.GetToken( index+0 )->GetValue< U32 >();
+        const U32 numItems = block.GetValue< U32 >( index+0 );
         
         if ( ( index + numItems + 1 ) >= block.Size() )
     	{
@@ -71,8 +61,8 @@ void FieldFit::ReadSumConstraints( const Block &block, const Units &units, Const
         }
         
         const std::string fitFlags = block.GetToken( index+0 )->GetToken();
-        constraint.SetTarget( block.GetToken( index+1 )->GetValue< F64 >() );
-        constraint.SetForceConstant( block.GetToken( index+2 )->GetValue< F64 >() );
+        constraint.SetTarget( block.GetValue< F64 >( index+1 ) );
+        constraint.SetForceConstant( block.GetValue< F64 >( index+2 ) );
         constraint.SetFlags( StringTypeToFitFlags( fitFlags ) );
         
         // Perform a type conversion
@@ -127,7 +117,7 @@ void FieldFit::ReadSymConstraints( const Block &block, const Units &units, Const
         throw ArgException( "FieldFit", "ReadSymConstraints", "block [SYMCONSTR] was too small ( at least 1 argument expected ) !" );
     }
 
-    U32 constraints = block.GetToken( 0 )->GetValue< U32 >();
+    U32 constraints = block.GetValue< U32 >( 0 );
         
     if ( block.Size() != ( 1 + ( constraints * 3 ) ) )
     {
@@ -144,7 +134,7 @@ void FieldFit::ReadSymConstraints( const Block &block, const Units &units, Const
         std::string fitFlags = block.GetToken( index+1 )->GetToken();
         
         constraint.AddCoulType( name ); 
-        constraint.SetForceConstant( block.GetToken( index+2 )->GetValue< F64 >() );
+        constraint.SetForceConstant( block.GetValue< F64 >( index+2 ) );
         constraint.SetFlags( StringTypeToFitFlags( fitFlags ) ); 
         
         // Perform a type conversion
@@ -1,23 +1,41 @@
 #include "io/block.h"
+#include "io/tokenChunks.h"
+#include "io/tokenStream.h"
 #include "io/inSystem.h"
+#include "io/npyArray.h"
 #include "io/blockParser.h"
 
+#include "common/util.h"
 #include "common/exception.h"
+#include "common/threadPool.h"
 
 #include "configuration/system.h"
 #include "configuration/configuration.h"
 
 #include <set>
+#include <deque>
+#include <chrono>
+#include <future>
+#include <algorithm>
+#include <cstring>
 
 namespace FieldFit
 {
     void FillUnitsMap( Units &units, std::map< std::string, F64* > &map,
                        std::map< std::pair< std::string, std::string >, F64 > &unitsMap );  
+    
+    void ReadColumnMajorField( const F64 *values, const std::shared_ptr< const void > &source, U32 numSets, U32 numPoints, 
+                               const std::set< U32 > &collectionSet, System &sys );
+    
+    void ReadNpyGrid( const NpyArray &array, U32 numCoords, const Units &units, System &sys );
+    
+    void ReadNpyField( const NpyArray &array, U32 numSets, U32 numPoints, const Units &units, 
+                       const std::set< U32 > &collectionSet, System &sys );
 }
 
 FieldFit::Units* FieldFit::ReadUnits( BlockParser &bp )
 {
-    const Block *block = bp.GetBlock("UNITS");
+    std::unique_ptr< const Block > block = bp.GetBlock("UNITS");
     
     if ( !block )
     {
@@ -72,50 +90,46 @@ FieldFit::Units* FieldFit::ReadUnits( BlockParser &bp )
     return unitsObj;
 }
 
-void FieldFit::ReadGrids( BlockParser &bp, const Units &units, Configuration &config )
+void FieldFit::ReadGrids( BlockParser &bp, const Units &units, Configuration &config, ThreadPool &pool )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("GRID");
+    const size_t numBlocks = bp.NumBlocks("GRID");
     
-    if ( !blockArray )
+    if ( numBlocks == 0 )
     {
         throw ArgException( "FieldFit", "ReadGrids", "block GRID was not present!" );
     }
     
-    for ( const Block &block : *blockArray )
+    // each block is only tokenized for as long as it is being read
+    for ( size_t i=0; i < numBlocks; ++i )
     { 
-        ReadGrid(block,units,config);
+        ReadGrid( bp.GetBlock( "GRID", i ), units, config, pool );
     }
 
     bp.DeleteBlock("GRID");
 }
 
-void FieldFit::ReadFields( BlockParser &bp, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection )
+void FieldFit::ReadFields( BlockParser &bp, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection, ThreadPool &pool )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("FIELD");
+    const size_t numBlocks = bp.NumBlocks("FIELD");
     
-    if ( !blockArray )
+    if ( numBlocks == 0 )
     {
         throw ArgException( "FieldFit", "ReadFields", "block FIELD was not present!" );
     }
 
-    for ( const Block &block : *blockArray )
+    for ( size_t i=0; i < numBlocks; ++i )
     { 
-        ReadField(block,units,config, collectionSelection);
+        ReadField( bp.GetBlock( "FIELD", i ), units, config, collectionSelection, pool );
     }
 
     bp.DeleteBlock("FIELD");
 }
 
-void FieldFit::ReadEfields( BlockParser &bp, const Units &units, Configuration &config )
+void FieldFit::ReadEfields( BlockParser &bp, const Units &units, Configuration &config, ThreadPool &pool )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("EFIELD");
-    
-    if ( blockArray )
-    {
-        for ( const Block &block : *blockArray )
-        {   
-            ReadEfield(block, units, config);            
-        }
+    for ( size_t i=0, numBlocks=bp.NumBlocks("EFIELD"); i < numBlocks; ++i )
+    { 
+        ReadEfield( bp.GetBlock( "EFIELD", i ), units, config, pool );
     }
 
     bp.DeleteBlock("EFIELD");
@@ -123,16 +137,16 @@ void FieldFit::ReadEfields( BlockParser &bp, const Units &units, Configuration &
 
 void FieldFit::ReadSystems( BlockParser &bp, const Units &units, Configuration &config )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("SYSTEM");
+    const size_t numBlocks = bp.NumBlocks("SYSTEM");
     
-    if ( !blockArray )
+    if ( numBlocks == 0 )
     {
         throw ArgException( "FieldFit", "ReadSystems", "block [SYSTEM] was not present!" );
     }
     
-    for ( const Block &block : *blockArray )
+    for ( size_t i=0; i < numBlocks; ++i )
     {
-        System *newSys = ReadSystem( block, units );
+        System *newSys = ReadSystem( bp.GetBlock( "SYSTEM", i ), units );
         
         if ( !newSys )
         {
@@ -154,14 +168,9 @@ void FieldFit::ReadSystems( BlockParser &bp, const Units &units, Configuration &
 
 void FieldFit::ReadPermChargeSets( BlockParser &bp, const Units &units, Configuration &config )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("PERMCHARGES");
-    
-    if ( blockArray )
-    {
-        for ( const Block &block : *blockArray )
-        { 
-            ReadPermChargeSet(block,units,config);
-        }
+    for ( size_t i=0, numBlocks=bp.NumBlocks("PERMCHARGES"); i < numBlocks; ++i )
+    { 
+        ReadPermChargeSet(bp.GetBlock( "PERMCHARGES", i ),units,config);
     }
 
     bp.DeleteBlock("PERMCHARGES");
@@ -169,20 +178,248 @@ void FieldFit::ReadPermChargeSets( BlockParser &bp, const Units &units, Configur
 
 void FieldFit::ReadPermDipoleSets( BlockParser &bp, const Units &units, Configuration &config )
 {
-    const std::vector< Block > *blockArray = bp.GetBlockArray("PERMDIPOLES");
+    for ( size_t i=0, numBlocks=bp.NumBlocks("PERMDIPOLES"); i < numBlocks; ++i )
+    { 
+        ReadPermDipoleSet(bp.GetBlock( "PERMDIPOLES", i ),units,config);
+    }
+
+    bp.DeleteBlock("PERMDIPOLES");
+}
+
+F64 FieldFit::ReadAndUpdateSystems( BlockParser &bp, const Units &units, Configuration &config, 
+                                    const std::vector< U32 > &collectionSelection, ThreadPool &pool, size_t maxPending )
+{
+    const std::vector< std::string > titles = { "GRID", "FIELD", "EFIELD", "PERMCHARGES", "PERMDIPOLES" };
+    
+    // per system, the indices of its blocks that were not read yet for each of the titles
+    std::map< std::string, std::vector< std::vector< size_t > > > systemBlocks;
+    
+    // the blocks of each title, and the systems, of the files merged so far that were handled
+    std::vector< size_t > numGrouped( titles.size(), 0 );
+    size_t numSystems = 0;
+    
+    auto readBlocks = [&]( const std::vector< std::vector< size_t > > &blocks )
+    {
+        for ( size_t t=0; t < titles.size(); ++t )
+        {
+            for ( size_t i : blocks[t] )
+            {
+                const Block block = bp.GetBlock( titles[t], i );
+                
+                switch ( t )
+                {
+                    case 0: ReadGrid( block, units, config, pool ); break;
+                    case 1: ReadField( block, units, config, collectionSelection, pool ); break;
+                    case 2: ReadEfield( block, units, config, pool ); break;
+                    case 3: ReadPermChargeSet( block, units, config ); break;
+                    case 4: ReadPermDipoleSet( block, units, config ); break;
+                }
+                
+                bp.Release( titles[t], i );
+            }
+        }
+    };
+    
+    // systems of which the update is still running, in the order they were read
+    std::deque< std::future< void > > pending;
+    
+    // systems that were submitted, blocks of them in later files update them once more
+    std::set< const System* > submitted;
+    
+    // systems that were read but not submitted yet, later blocks of a partly merged file may still belong to them
+    std::vector< System* > waiting;
+    
+    System::UpdateOptions options;
+    options.gramTiles = config.GetGramTiles();
+    options.releaseCoefficients = config.GetReleaseCoefficients();
+    options.permTreeTheta = config.GetPermTreeTheta();
+    options.mixedPrecision = config.GetMixedPrecision();
+    options.compactStorage = config.GetCompactStorage();
+    
+    F64 waitSeconds = 0.0;
+    
+    // the oldest update leaves the queue before its error can be rethrown
+    auto waitFront = [&pending, &pool, &waitSeconds]()
+    {
+        std::future< void > update = std::move( pending.front() );
+        pending.pop_front();
+        
+        auto t0 = std::chrono::high_resolution_clock::now();
+        pool.Wait( update );
+        auto t1 = std::chrono::high_resolution_clock::now();
+        
+        waitSeconds += std::chrono::duration_cast< std::chrono::duration< F64 > >( t1 - t0 ).count();
+        
+        update.get();
+    };
     
-    if ( blockArray )
+    auto submit = [&]( System *sys )
+    {
+        submitted.insert( sys );
+        
+        // the system is complete, only its own data is touched by the update
+        pending.push_back( pool.Submit( [sys, &pool, options]() { sys->OnUpdate2( pool, options ); } ) );
+        
+        while ( pending.size() > maxPending )
+        {
+            waitFront();
+        }
+    };
+    
+    try
+    {
+        // the systems are read as soon as the files that hold them are indexed, while later files still are
+        do
+        {
+            // the systems to read, in the order their blocks first appeared
+            std::vector< std::string > names;
+            
+            for ( const System *sys : waiting )
+            {
+                names.push_back( sys->GetName() );
+            }
+            
+            for ( const size_t numBlocks = bp.NumBlocks("SYSTEM"); numSystems < numBlocks; ++numSystems )
+            {
+                System *newSys = ReadSystem( bp.GetBlock( "SYSTEM", numSystems ), units );
+                
+                if ( !newSys )
+                {
+                    throw ArgException( "FieldFit", "ReadSystems", "Unable to parse a system blocks" );
+                }
+                
+                const System *it = config.FindSystem( newSys->GetName() );
+                
+                if ( it )
+                {
+                    throw ArgException( "FieldFit", "ReadSystems", "Duplicate system name " + newSys->GetName() );
+                }
+                
+                config.InsertSystem(newSys);
+                names.push_back( newSys->GetName() );
+            }
+            
+            for ( size_t t=0; t < titles.size(); ++t )
+            {
+                for ( const size_t numBlocks = bp.NumBlocks( titles[t] ); numGrouped[t] < numBlocks; ++numGrouped[t] )
+                {
+                    const std::string name = bp.GetFirstToken( titles[t], numGrouped[t] );
+                    std::vector< std::vector< size_t > > &blocks = systemBlocks[ name ];
+                    
+                    blocks.resize( titles.size() );
+                    blocks[t].push_back( numGrouped[t] );
+                    
+                    names.push_back( name );
+                }
+            }
+            
+            for ( const std::string &name : names )
+            {
+                System *sys = config.FindSystem( name );
+                auto itb = systemBlocks.find( name );
+                
+                // blocks of a system that is not known yet wait for it, or are reported once all files are merged
+                if ( !sys )
+                {
+                    continue;
+                }
+                
+                const bool update = submitted.count( sys ) != 0;
+                
+                if ( itb != systemBlocks.end() )
+                {
+                    // a field is read onto its grid, so neither is read before both are known
+                    if ( !update && !( ( sys->GetGrid() || !itb->second[0].empty() ) && ( sys->GetField() || !itb->second[1].empty() ) ) )
+                    {
+                        continue;
+                    }
+                    
+                    // a block in a later file than its system, the running update must not see it change
+                    while ( update && !pending.empty() )
+                    {
+                        waitFront();
+                    }
+                    
+                    readBlocks( itb->second );
+                    systemBlocks.erase( itb );
+                    
+                    if ( std::find( waiting.begin(), waiting.end(), sys ) == waiting.end() )
+                    {
+                        waiting.push_back( sys );
+                    }
+                }
+                
+                auto itw = std::find( waiting.begin(), waiting.end(), sys );
+                
+                // the update waits until the partly merged file moved on to other blocks
+                if ( itw == waiting.end() || name == bp.GetPartialFirstToken() )
+                {
+                    continue;
+                }
+                
+                waiting.erase( itw );
+                submit( sys );
+            }
+        }
+        while ( bp.MergeNext() );
+        
+        if ( bp.NumBlocks("SYSTEM") == 0 )
+        {
+            throw ArgException( "FieldFit", "ReadSystems", "block [SYSTEM] was not present!" );
+        }
+        
+        if ( bp.NumBlocks("GRID") == 0 )
+        {
+            throw ArgException( "FieldFit", "ReadGrids", "block GRID was not present!" );
+        }
+        
+        if ( bp.NumBlocks("FIELD") == 0 )
+        {
+            throw ArgException( "FieldFit", "ReadFields", "block FIELD was not present!" );
+        }
+        
+        // the readers report the blocks of unknown and incomplete systems
+        for ( const auto &blocks : systemBlocks )
+        {
+            readBlocks( blocks.second );
+        }
+        
+        // the update reports what an incomplete system is missing
+        for ( System *sys : config.GetSystems() )
+        {
+            if ( submitted.count( sys ) == 0 )
+            {
+                submit( sys );
+            }
+        }
+        
+        while ( !pending.empty() )
+        {
+            waitFront();
+        }
+    }
+    catch ( ... )
     {
-        for ( const Block &block : *blockArray )
-        { 
-            ReadPermDipoleSet(block,units,config);
+        // the updates still use their systems and the pool, neither of which may go before them
+        for ( std::future< void > &update : pending )
+        {
+            pool.Wait( update );
         }
+        
+        throw;
     }
-
-    bp.DeleteBlock("PERMDIPOLES");
+    
+    bp.DeleteBlock("SYSTEM");
+    
+    for ( const std::string &title : titles )
+    {
+        bp.DeleteBlock( title );
+    }
+    
+    return waitSeconds;
 }
 
-void FieldFit::ReadGrid( const Block &block, const Units &units, Configuration &config )
+void FieldFit::ReadGrid( const Block &block, const Units &units, Configuration &config, ThreadPool &pool )
 {   
     if ( block.Size() < 2 )
     {
@@ -190,7 +427,7 @@ void FieldFit::ReadGrid( const Block &block, const Units &units, Configuration &
     }
     
     const std::string systemName = block.GetToken( 0 )->GetToken();
-    const U32 numCoords = block.GetToken( 1 )->GetValue< U32 >();
+    const U32 numCoords = block.GetValue< U32 >( 1 );
     
     System *sys = config.FindSystem( systemName );
     
@@ -199,32 +436,59 @@ void FieldFit::ReadGrid( const Block &block, const Units &units, Configuration &
         throw ArgException( "FieldFit", "ReadGrid", "System with name "+systemName+" not found!" );
     }
     
-    arma::vec x = arma::zeros( numCoords );
-    arma::vec y = arma::zeros( numCoords );
-    arma::vec z = arma::zeros( numCoords );
+    if ( block.HasPayload() )
+    {
+        if ( block.PayloadRows() != numCoords || block.PayloadCols() != 3 )
+        {
+            throw ArgException( "FieldFit", "ReadGrid", "binary block [GRID] does not match its size indicator !" );
+        }
+        
+        // the coordinates are already in internal units and are used in place
+        const F64 *payload = block.GetPayload();
+        
+        sys->InsertGrid( new Grid( payload, payload + numCoords, payload + 2 * numCoords, numCoords, block.GetSource() ) );
+        
+        return;
+    }
     
-    //test for the correct size
-    if ( block.Size() != ( 2  + ( numCoords * 3 ) ) )
+    const std::string npyFile = NpyArray::Reference( block );
+    
+    if ( !npyFile.empty() )
     {
-        throw ArgException( "FieldFit", "ReadGrid", "block [GRID] did not have the right amount of arguments based on the size indicators !" );
+        ReadNpyGrid( NpyArray( npyFile ), numCoords, units, *sys );
+        
+        return;
     }
     
+    arma::vec x = arma::zeros( numCoords );
+    arma::vec y = arma::zeros( numCoords );
+    arma::vec z = arma::zeros( numCoords );
+    
     const F64 coordConv = units.GetCoordConv();
+    F64 *coords[3] = { x.memptr(), y.memptr(), z.memptr() };
     
-    U32 index = 2;
+    // the coordinates follow the header untokenized, every chunk fills its own range of points
+    TokenChunks chunks( block, size_t( numCoords ) * 3, pool );
     
-    for ( U32 i=0; i < numCoords; ++i,index+=3 )
+    const bool validSize = chunks.ForEach( [&]( TokenStream &stream, size_t first, size_t count )
     {
-        x[i] = block.GetToken( index+0 )->GetValue< F64 >() * coordConv;
-        y[i] = block.GetToken( index+1 )->GetValue< F64 >() * coordConv;
-        z[i] = block.GetToken( index+2 )->GetValue< F64 >() * coordConv;
+        for ( size_t k = first, last = first + count; k < last; ++k )
+        {
+            coords[ k % 3 ][ k / 3 ] = stream.NextValue< F64 >() * coordConv;
+        }
+    } );
+    
+    //test for the correct size
+    if ( !validSize )
+    {
+        throw ArgException( "FieldFit", "ReadGrid", "block [GRID] did not have the right amount of arguments based on the size indicators !" );
     }
     
     Grid *newGrid = new Grid( x, y, z );
     sys->InsertGrid(newGrid);
 }
 
-void FieldFit::ReadField( const Block &block, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection )
+void FieldFit::ReadField( const Block &block, const Units &units, Configuration &config, const std::vector< U32 > &collectionSelection, ThreadPool &pool )
 {   
     if ( block.Size() < 3 )
     {
@@ -232,8 +496,8 @@ void FieldFit::ReadField( const Block &block, const Units &units, Configuration
     }
     
     const std::string &systemName = block.GetToken( 0 )->GetToken();
-    const U32 numSets   = block.GetToken( 1 )->GetValue< U32 >();
-    const U32 numPoints = block.GetToken( 2 )->GetValue< U32 >();
+    const U32 numSets   = block.GetValue< U32 >( 1 );
+    const U32 numPoints = block.GetValue< U32 >( 2 );
 
     System *sys = config.FindSystem( systemName );
     
@@ -249,9 +513,7 @@ void FieldFit::ReadField( const Block &block, const Units &units, Configuration
         throw ArgException( "FieldFit", "ReadField", "Grid for system with name "+systemName+" not found!" );
     }
     
-    if ( numPoints != grid->GetX().n_elem ||
-         numPoints != grid->GetY().n_elem || 
-         numPoints != grid->GetZ().n_elem  )
+    if ( numPoints != grid->Size() )
     {
         throw ArgException( "FieldFit", "ReadField", "configuration "+systemName+" was assigned a field matrix that does not match its grid" );
     }
@@ -281,36 +543,74 @@ void FieldFit::ReadField( const Block &block, const Units &units, Configuration
     // we might do a subselection so do that that into account
     const U32 numEffectiveSets = collectionSet.size();
     
-    arma::mat potentials = arma::zeros( numPoints, numEffectiveSets );
-
-    //test for the correct size
-    if ( block.Size() != ( 3 + ( numPoints * numSets ) ) )
+    if ( block.HasPayload() )
     {
-        throw ArgException( "FieldFit", "ReadField", "block [FIELD] did not have the right amount of arguments based on the size indicators !" );    
+        if ( block.PayloadRows() != numPoints || block.PayloadCols() != numSets )
+        {
+            throw ArgException( "FieldFit", "ReadField", "binary block [FIELD] does not match its size indicators !" );
+        }
+        
+        ReadColumnMajorField( block.GetPayload(), block.GetSource(), numSets, numPoints, collectionSet, *sys );
+        
+        return;
+    }
+    
+    const std::string npyFile = NpyArray::Reference( block );
+    
+    if ( !npyFile.empty() )
+    {
+        ReadNpyField( NpyArray( npyFile ), numSets, numPoints, units, collectionSet, *sys );
+        
+        return;
     }
     
+    arma::mat potentials = arma::zeros( numPoints, numEffectiveSets );
+
     const F64 potConv = units.GetPotConv();
     
-    U32 index = 3;
+    // column of every set in the potentials, or -1 when it was not selected
+    std::vector< S32 > columns( numSets, -1 );
     U32 column = 0;
-
-    for ( U32 s=0; s < numSets; ++s )
+    
+    for ( auto it = collectionSet.begin(), itend = collectionSet.end(); it != itend; ++it )
     {
-        // test if we actually want to read here or just increment index
-        if ( collectionSet.find(s) != collectionSet.end() )
+        columns[ *it ] = column++;
+    }
+    
+    // the values follow the header untokenized, every chunk fills its own range of the potentials
+    // and skips the values of unselected sets without converting them
+    TokenChunks chunks( block, size_t( numPoints ) * numSets, pool );
+    
+    const bool validSize = chunks.ForEach( [&]( TokenStream &stream, size_t first, size_t count )
+    {
+        for ( size_t k = first, last = first + count; k < last; )
         {
-            //std::cout << "SELECTING FIELD SET " << s << std::endl;
-            for ( U32 i=0; i < numPoints; ++i,index++ )
+            const size_t set = k / numPoints;
+            const size_t point = k % numPoints;
+            const size_t n = std::min< size_t >( numPoints - point, last - k );
+            
+            if ( columns[ set ] < 0 )
             {
-                potentials.col(column)[i] = block.GetToken( index )->GetValue< F64 >() * potConv;
+                stream.Skip( n );
             }
-
-            column++;
-        }
-        else
-        {
-            index+=numPoints;
+            else
+            {
+                F64 *potential = potentials.colptr( columns[ set ] ) + point;
+                
+                for ( size_t i=0; i < n; ++i )
+                {
+                    potential[i] = stream.NextValue< F64 >() * potConv;
+                }
+            }
+            
+            k += n;
         }
+    } );
+    
+    //test for the correct size
+    if ( !validSize )
+    {
+        throw ArgException( "FieldFit", "ReadField", "block [FIELD] did not have the right amount of arguments based on the size indicators !" );    
     }
 
     if ( column != numEffectiveSets )
@@ -322,24 +622,32 @@ void FieldFit::ReadField( const Block &block, const Units &units, Configuration
     sys->InsertField( newField );
 }
 
-void FieldFit::ReadEfield( const Block &block, const Units &units, Configuration &config )
+void FieldFit::ReadEfield( const Block &block, const Units &units, Configuration &config, ThreadPool &pool )
 {
     if ( block.Size() < 3 )
     {
         throw ArgException( "FieldFit", "ReadEfield", "block [EFIELD] was too small ( at least 2 argument expected ) !" );    
     }
     
-    const std::string &systemName = block.GetToken( 0 )->GetToken();
-    const U32 sites       = block.GetToken( 1 )->GetValue< U32 >();
-    const U32 setsPerSite = block.GetToken( 2 )->GetValue< U32 >();
+    const std::string systemName = block.GetToken( 0 )->GetToken();
+    const U32 sites       = block.GetValue< U32 >( 1 );
+    const U32 setsPerSite = block.GetValue< U32 >( 2 );
     
     System *sys = config.FindSystem( systemName );
     if ( !sys )
     {
         throw ArgException( "FieldFit", "ReadEfield", "System with name "+systemName+" not found!" );
     }
+    
+    // binary blocks only hold the site names as tokens, the fields are a ( 3 * setsPerSite ) x sites payload
+    const bool binary = block.HasPayload();
        
-    if ( block.Size() != ( 3 + ( sites + sites * setsPerSite * 3 ) ) )
+    if ( binary && ( block.Size() != 3 + sites || block.PayloadRows() != 3 * setsPerSite || block.PayloadCols() != sites ) )
+    {
+        throw ArgException( "FieldFit", "ReadEfield", "binary block [EFIELD] does not match its size indicator!" );
+    }
+    
+    if ( !binary && block.Size() != 3 )
     {
         throw ArgException( "FieldFit", "ReadEfield", "block [EFIELD] did not have the right amount of arguments based on the size indicator!" );
     }
@@ -359,59 +667,145 @@ void FieldFit::ReadEfield( const Block &block, const Units &units, Configuration
     const std::set< U32 > &collectionSet = field->GetCollectionSet();
     const size_t effectiveSetsPerSite = collectionSet.size();
     const F64 efieldConv = units.GetEfieldConv();
-
-    U32 index = 3;
-    for ( U32 i=0; i < sites; ++i )
+    
+    // row of every set in the efields, or -1 when it was not selected
+    std::vector< S32 > rows( setsPerSite, -1 );
+    S32 row = 0;
+    
+    for ( auto it = collectionSet.begin(), itend = collectionSet.end(); it != itend; ++it )
     {
-        const std::string name = block.GetToken( index+0 )->GetToken();
-        
-        index++;
-        
-        Site *site = sys->FindSite( name );
-        
-        // skip
-        if ( !site )
+        rows[ *it ] = row++;
+    }
+    
+    // every site is a name followed by ef_xyz for all sets
+    const size_t stride = 1 + 3 * size_t( setsPerSite );
+    
+    std::vector< std::string > names( sites );
+    TokenChunks chunks( block, sites * stride, pool );
+    
+    if ( binary )
+    {
+        for ( U32 i=0; i < sites; ++i )
         {
-            index+=3*setsPerSite;
-            continue;
+            names[i] = block.GetToken( 3+i )->GetToken();
         }
+    }
+    else
+    {
+        // text blocks keep everything after the header untokenized, so first only pick up the names
+        const bool validSize = chunks.ForEach( [&]( TokenStream &stream, size_t first, size_t count )
+        {
+            for ( size_t k = first, last = first + count; k < last; )
+            {
+                const size_t r = k % stride;
+                
+                if ( r == 0 )
+                {
+                    names[ k / stride ] = stream.NextToken();
+                    k++;
+                }
+                else
+                {
+                    const size_t n = std::min( stride - r, last - k );
+                    stream.Skip( n );
+                    k += n;
+                }
+            }
+        } );
         
-        arma::vec ex;
-        arma::vec ey;
-        arma::vec ez;
-        ex.resize( effectiveSetsPerSite );
-        ey.resize( effectiveSetsPerSite );
-        ez.resize( effectiveSetsPerSite );
+        if ( !validSize )
+        {
+            throw ArgException( "FieldFit", "ReadEfield", "block [EFIELD] did not have the right amount of arguments based on the size indicator!" );
+        }
+    }
+    
+    // the field is only used to fit polarizabilities, all other sites are never converted
+    std::vector< Site* > alphaSites( sites, nullptr );
+    std::vector< arma::vec > efields[3];
+    
+    for ( U32 c=0; c < 3; ++c )
+    {
+        efields[c].resize( sites );
+    }
+    
+    for ( U32 i=0; i < sites; ++i )
+    {
+        Site *site = sys->FindSite( names[i] );
         
-        // read ef_xyz
-        U32 row = 0;
-        for ( U32 s=0; s < setsPerSite; ++s )
+        if ( site && site->TestSpecialType( SpecialFlag::alpha ) )
         {
-            // do we want to subselect this set?
-            if ( collectionSet.find(s) != collectionSet.end() )
+            alphaSites[i] = site;
+            
+            for ( U32 c=0; c < 3; ++c )
             {
-                //std::cout << "EFIELD_SELECT " << s << std::endl;
-
-                F64 efx = block.GetToken( index+0 )->GetValue< F64 >() * efieldConv;
-                F64 efy = block.GetToken( index+1 )->GetValue< F64 >() * efieldConv;
-                F64 efz = block.GetToken( index+2 )->GetValue< F64 >() * efieldConv;
-                
-                ex[row] = efx;
-                ey[row] = efy;
-                ez[row] = efz;
-
-                row++;
+                efields[c][i].resize( effectiveSetsPerSite );
             }
+        }
+    }
+    
+    if ( binary )
+    {
+        for ( U32 i=0; i < sites; ++i )
+        {
+            const F64 *payload = block.GetPayload() + i * 3 * setsPerSite;
             
-            index+=3;
+            for ( U32 s=0; s < setsPerSite && alphaSites[i]; ++s )
+            {
+                if ( rows[s] >= 0 )
+                {
+                    for ( U32 c=0; c < 3; ++c )
+                    {
+                        efields[c][i][ rows[s] ] = payload[ 3*s+c ];
+                    }
+                }
+            }
         }
-
-        if ( row != effectiveSetsPerSite )
+    }
+    else
+    {
+        chunks.ForEach( [&]( TokenStream &stream, size_t first, size_t count )
         {
-            throw ArgException( "FieldFit", "ReadEfield", "Number of promised subselections does not match number of read in rows!" );
+            for ( size_t k = first, last = first + count; k < last; )
+            {
+                const size_t i = k / stride;
+                const size_t r = k % stride;
+                const size_t n = std::min( stride - r, last - k );
+                
+                if ( r == 0 || !alphaSites[i] )
+                {
+                    // the name, or a site we do not need at all
+                    const size_t skip = r == 0 ? 1 : n;
+                    stream.Skip( skip );
+                    k += skip;
+                    
+                    continue;
+                }
+                
+                for ( size_t j = r - 1; j < r - 1 + n; ++j )
+                {
+                    const S32 setRow = rows[ j / 3 ];
+                    
+                    if ( setRow < 0 )
+                    {
+                        stream.Skip( 1 );
+                    }
+                    else
+                    {
+                        efields[ j % 3 ][i][ setRow ] = stream.NextValue< F64 >() * efieldConv;
+                    }
+                }
+                
+                k += n;
+            }
+        } );
+    }
+    
+    for ( U32 i=0; i < sites; ++i )
+    {
+        if ( alphaSites[i] )
+        {
+            alphaSites[i]->AddEfield( efields[0][i], efields[1][i], efields[2][i] );
         }
-        
-        site->AddEfield( ex, ey, ez );
     }
 }
 
@@ -425,14 +819,22 @@ FieldFit::System* FieldFit::ReadSystem( const Block &block, const Units &units
     }
 
     const std::string systemName = block.GetToken( 0 )->GetToken();
-    const U32 numSites = block.GetToken( 1 )->GetValue< U32 >();
+    const U32 numSites = block.GetValue< U32 >( 1 );
 
     if ( numSites < 1 )
     {
         throw ArgException( "FieldFit", "ReadSystem", "in block [SYSTEM] at least 1 fit site was expected!" );
     }
         
-    if ( block.Size() != ( 2 + ( numSites * 6 ) ) )
+    // binary blocks only hold the names and flags as tokens, the coordinates are a numSites x 3 payload
+    const bool binary = block.HasPayload();
+    
+    if ( binary && ( block.Size() != 2 + numSites * 3 || block.PayloadRows() != numSites || block.PayloadCols() != 3 ) )
+    {
+        throw ArgException( "FieldFit", "ReadSystem", "binary block [SYSTEM] does not match its size indicator!" );
+    }
+        
+    if ( !binary && block.Size() != ( 2 + ( numSites * 6 ) ) )
     {
         throw ArgException( "FieldFit", "ReadSystem", "block [SYSTEM] did not have the right amount of arguments based on the size indicator!" );
     }
@@ -440,6 +842,7 @@ FieldFit::System* FieldFit::ReadSystem( const Block &block, const Units &units
     newSys = new System( systemName );
 
     const F64 coordConv = units.GetCoordConv();
+    const F64 *payload = block.GetPayload();
 
     U32 index = 2;
 
@@ -449,16 +852,16 @@ FieldFit::System* FieldFit::ReadSystem( const Block &block, const Units &units
         const std::string coulFlag = block.GetToken( index+1 )->GetToken();
         const std::string fitFlags = block.GetToken( index+2 )->GetToken();
         
-        const F64 coord_x = block.GetToken( index+3 )->GetValue< F64 >() * coordConv;
-        const F64 coord_y = block.GetToken( index+4 )->GetValue< F64 >() * coordConv;
-        const F64 coord_z = block.GetToken( index+5 )->GetValue< F64 >() * coordConv;
+        const F64 coord_x = binary ? payload[ i + 0 * numSites ] : block.GetValue< F64 >( index+3 ) * coordConv;
+        const F64 coord_y = binary ? payload[ i + 1 * numSites ] : block.GetValue< F64 >( index+4 ) * coordConv;
+        const F64 coord_z = binary ? payload[ i + 2 * numSites ] : block.GetValue< F64 >( index+5 ) * coordConv;
         
         U32 fitTypes = StringTypeToFitFlags( fitFlags );
         
         Site *site = new Site( fitTypes, atomName, coulFlag, coord_x, coord_y, coord_z );
         newSys->InsertSite(site);
         
-        index += 6;
+        index += binary ? 3 : 6;
     }
     
     return newSys;
@@ -472,9 +875,17 @@ void FieldFit::ReadPermChargeSet( const Block &block, const Units &units, Config
     }
     
     const std::string &systemName = block.GetToken( 0 )->GetToken();
-    const U32 permSites = block.GetToken( 1 )->GetValue< U32 >();
+    const U32 permSites = block.GetValue< U32 >( 1 );
+    
+    // binary blocks hold the sites as a permSites x 4 payload
+    const bool binary = block.HasPayload();
+    
+    if ( binary && ( block.Size() != 2 || block.PayloadRows() != permSites || block.PayloadCols() != 4 ) )
+    {
+        throw ArgException( "FieldFit", "ReadPermChargeSet", "binary block [PERMCHARGES] does not match its size indicator!" );    
+    }
     
-    if ( block.Size() != ( 2 + ( permSites * 4 ) ) )
+    if ( !binary && block.Size() != ( 2 + ( permSites * 4 ) ) )
     {
         throw ArgException( "FieldFit", "ReadPermChargeSet", "block [PERMCHARGES] did not have the right amount of arguments based on the size indicator!" );    
     }
@@ -487,17 +898,18 @@ void FieldFit::ReadPermChargeSet( const Block &block, const Units &units, Config
        
     const F64 coordConv  = units.GetCoordConv();
     const F64 chargeConv = units.GetChargeConv();
+    const F64 *payload = block.GetPayload();
     
     U32 index = 2;
     for ( U32 i=0; i < permSites; ++i )
     {
-        const F64 x = block.GetToken( index+0 )->GetValue< F64 >() * coordConv;
-        const F64 y = block.GetToken( index+1 )->GetValue< F64 >() * coordConv;
-        const F64 z = block.GetToken( index+2 )->GetValue< F64 >() * coordConv;
-        const F64 val = block.GetToken( index+3 )->GetValue< F64 >() * chargeConv;
+        const F64 x = binary ? payload[ i + 0 * permSites ] : block.GetValue< F64 >( index+0 ) * coordConv;
+        const F64 y = binary ? payload[ i + 1 * permSites ] : block.GetValue< F64 >( index+1 ) * coordConv;
+        const F64 z = binary ? payload[ i + 2 * permSites ] : block.GetValue< F64 >( index+2 ) * coordConv;
+        const F64 val = binary ? payload[ i + 3 * permSites ] : block.GetValue< F64 >( index+3 ) * chargeConv;
         
-        PermSite *psite = new PermSite( x, y, z, val, FitType::charge );        
-        sys->InsertPermSite(psite);
+        const PermMultipole multipole = { x, y, z, val, 0.0, 0.0, 0.0 };
+        sys->InsertPermMultipole( multipole );
 
         index += 4;
     }
@@ -511,9 +923,17 @@ void FieldFit::ReadPermDipoleSet( const Block &block, const Units &units, Config
     }
     
     const std::string &systemName = block.GetToken( 0 )->GetToken();
-    const U32 permSites = block.GetToken( 1 )->GetValue< U32 >();
+    const U32 permSites = block.GetValue< U32 >( 1 );
+    
+    // binary blocks hold the sites as a permSites x 6 payload
+    const bool binary = block.HasPayload();
     
-    if ( block.Size() != ( 2 + ( permSites * 6 ) ) )
+    if ( binary && ( block.Size() != 2 || block.PayloadRows() != permSites || block.PayloadCols() != 6 ) )
+    {
+        throw ArgException( "FieldFit", "ReadPermDipoleSet", "binary block [PERMDIPOLES] does not match its size indicator!" );    
+    }
+    
+    if ( !binary && block.Size() != ( 2 + ( permSites * 6 ) ) )
     {
         throw ArgException( "FieldFit", "ReadPermDipoleSet", "block [PERMDIPOLES] did not have the right amount of arguments based on the size indicator!" );    
     }
@@ -526,30 +946,123 @@ void FieldFit::ReadPermDipoleSet( const Block &block, const Units &units, Config
     
     const F64 coordConv  = units.GetCoordConv();
     const F64 dipoleConv = units.GetDipoleConv();
+    const F64 *payload = block.GetPayload();
     
     U32 index = 2;
 
     for ( U32 i=0; i < permSites; ++i )
     {
-        const F64 x = block.GetToken( index+0 )->GetValue< F64 >() * coordConv;
-        const F64 y = block.GetToken( index+1 )->GetValue< F64 >() * coordConv;
-        const F64 z = block.GetToken( index+2 )->GetValue< F64 >() * coordConv;
-        const F64 valX = block.GetToken( index+3 )->GetValue< F64 >() * dipoleConv;
-        const F64 valY = block.GetToken( index+4 )->GetValue< F64 >() * dipoleConv;
-        const F64 valZ = block.GetToken( index+5 )->GetValue< F64 >() * dipoleConv;
-        
-        PermSite *psiteX = new PermSite( x, y, z, valX, FitType::dipoleX );  
-        PermSite *psiteY = new PermSite( x, y, z, valY, FitType::dipoleY );
-        PermSite *psiteZ = new PermSite( x, y, z, valZ, FitType::dipoleZ );
-              
-        sys->InsertPermSite(psiteX);
-        sys->InsertPermSite(psiteY);
-        sys->InsertPermSite(psiteZ);
+        const F64 x = binary ? payload[ i + 0 * permSites ] : block.GetValue< F64 >( index+0 ) * coordConv;
+        const F64 y = binary ? payload[ i + 1 * permSites ] : block.GetValue< F64 >( index+1 ) * coordConv;
+        const F64 z = binary ? payload[ i + 2 * permSites ] : block.GetValue< F64 >( index+2 ) * coordConv;
+        const F64 valX = binary ? payload[ i + 3 * permSites ] : block.GetValue< F64 >( index+3 ) * dipoleConv;
+        const F64 valY = binary ? payload[ i + 4 * permSites ] : block.GetValue< F64 >( index+4 ) * dipoleConv;
+        const F64 valZ = binary ? payload[ i + 5 * permSites ] : block.GetValue< F64 >( index+5 ) * dipoleConv;
+        
+        // a single record carries the whole dipole
+        const PermMultipole multipole = { x, y, z, 0.0, valX, valY, valZ };
+        sys->InsertPermMultipole( multipole );
 
         index += 6;
     }
 }
 
+void FieldFit::ReadColumnMajorField( const F64 *values, const std::shared_ptr< const void > &source, U32 numSets, U32 numPoints, 
+                                     const std::set< U32 > &collectionSet, System &sys )
+{
+    const U32 first = collectionSet.empty() ? 0 : *collectionSet.begin();
+    const U32 last  = collectionSet.empty() ? 0 : *collectionSet.rbegin() + 1;
+    
+    // a consecutive selection of sets is a consecutive range of columns, so it can be used in place
+    if ( last - first == collectionSet.size() )
+    {
+        sys.InsertField( new Field( values + size_t( first ) * numPoints, numPoints, collectionSet.size(), 
+                                    collectionSet, numSets, source ) );
+        
+        return;
+    }
+    
+    arma::mat potentials( numPoints, collectionSet.size() );
+    
+    U32 column = 0;
+    
+    for ( auto it = collectionSet.begin(), itend = collectionSet.end(); it != itend; ++it, ++column )
+    {
+        memcpy( potentials.colptr( column ), values + size_t( *it ) * numPoints, numPoints * sizeof( F64 ) );
+    }
+    
+    sys.InsertField( new Field( potentials, collectionSet, numSets ) );
+}
+
+void FieldFit::ReadNpyGrid( const NpyArray &array, U32 numCoords, const Units &units, System &sys )
+{
+    if ( !array.HasShape( numCoords, 3 ) )
+    {
+        throw ArgException( "FieldFit", "ReadGrid", "npy file "+array.GetName()+" of block [GRID] does not have the shape ( "+Util::ToString( numCoords )+", 3 ) !" );
+    }
+    
+    const F64 coordConv = units.GetCoordConv();
+    
+    // coordinates that need no conversion are used in place
+    if ( array.IsColumnMajor() && coordConv == 1.0 )
+    {
+        const F64 *values = array.Data();
+        
+        sys.InsertGrid( new Grid( values, values + numCoords, values + 2 * size_t( numCoords ), numCoords, array.GetSource() ) );
+        
+        return;
+    }
+    
+    arma::vec coords[3] = { arma::vec( numCoords ), arma::vec( numCoords ), arma::vec( numCoords ) };
+    
+    for ( U32 c=0; c < 3; ++c )
+    {
+        F64 *coord = coords[c].memptr();
+        
+        for ( U32 i=0; i < numCoords; ++i )
+        {
+            coord[i] = array.At( i, c ) * coordConv;
+        }
+    }
+    
+    sys.InsertGrid( new Grid( coords[0], coords[1], coords[2] ) );
+}
+
+void FieldFit::ReadNpyField( const NpyArray &array, U32 numSets, U32 numPoints, const Units &units, 
+                             const std::set< U32 > &collectionSet, System &sys )
+{
+    if ( !array.HasShape( numPoints, numSets ) )
+    {
+        throw ArgException( "FieldFit", "ReadField", "npy file "+array.GetName()+" of block [FIELD] does not have the shape ( "+
+                            Util::ToString( numPoints )+", "+Util::ToString( numSets )+" ) !" );
+    }
+    
+    const F64 potConv = units.GetPotConv();
+    
+    if ( array.IsColumnMajor() && potConv == 1.0 )
+    {
+        ReadColumnMajorField( array.Data(), array.GetSource(), numSets, numPoints, collectionSet, sys );
+        
+        return;
+    }
+    
+    arma::mat potentials( numPoints, collectionSet.size() );
+    
+    U32 column = 0;
+    
+    for ( auto it = collectionSet.begin(), itend = collectionSet.end(); it != itend; ++it, ++column )
+    {
+        F64 *potential = potentials.colptr( column );
+        
+        for ( U32 i=0; i < numPoints; ++i )
+        {
+            potential[i] = array.At( i, *it ) * potConv;
+        }
+    }
+    
+    sys.InsertField( new Field( potentials, collectionSet, numSets ) );
+}
+
 void FieldFit::FillUnitsMap( Units &units, std::map< std::string, F64* > &nameToUnit,
                     	     std::map< std::pair< std::string, std::string >, F64 > &unitsMap )
 {
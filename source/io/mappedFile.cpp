@@ -0,0 +1,445 @@
+#include "io/mappedFile.h"
+
+#include "common/exception.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <algorithm>
+
+#include <zlib.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+    // deflate never compresses better than this
+    const size_t gMaxCompressionRatio = 1032;
+
+    // keeps the reservation well within the address space
+    const size_t gMaxReservation = size_t( 1 ) << 45;
+
+    // output granularity at which a following parser is woken up
+    const size_t gInflateChunk = 1 << 20;
+
+    // how long a stream read waits before looking whether it should stop
+    const int gPollMilliseconds = 100;
+
+    bool IsGzip( const char *data, size_t size )
+    {
+        return size >= 2 && static_cast< unsigned char >( data[0] ) == 0x1f && static_cast< unsigned char >( data[1] ) == 0x8b;
+    }
+}
+
+FieldFit::MappedFile::MappedFile( const std::string &file ) :
+    mName( file ), mRaw( nullptr ), mRawSize( 0 ), mMapped( false ), mReservation( nullptr ), mReserved( 0 ),
+    mAvailable( 0 ), mComplete( true ), mStopping( false ), mData( nullptr ), mSize( 0 )
+{
+    const bool isStdin = file == "-";
+    const int fd = isStdin ? STDIN_FILENO : open( file.c_str(), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+        throw ArgException( "MappedFile", "MappedFile", "Unable to open file "+file+" !" );
+    }
+
+    struct stat info;
+
+    if ( fstat( fd, &info ) != 0 )
+    {
+        if ( !isStdin )
+        {
+            close( fd );
+        }
+
+        throw ArgException( "MappedFile", "MappedFile", "Unable to stat file "+file+" !" );
+    }
+
+    if ( !S_ISREG( info.st_mode ) )
+    {
+        // pipes cannot be mapped nor seeked, so they are read front to back once, while they are indexed
+        try
+        {
+            StartStream( fd, !isStdin );
+        }
+        catch ( ... )
+        {
+            if ( !isStdin )
+            {
+                close( fd );
+            }
+
+            throw;
+        }
+
+        return;
+    }
+
+    // mmap does not accept empty ranges, an empty file is simply an empty buffer
+    if ( info.st_size > 0 )
+    {
+        mRawSize = info.st_size;
+
+        void *addr = mmap( nullptr, mRawSize, PROT_READ, MAP_PRIVATE, fd, 0 );
+
+        if ( addr == MAP_FAILED )
+        {
+            if ( !isStdin )
+            {
+                close( fd );
+            }
+
+            throw ArgException( "MappedFile", "MappedFile", "Unable to map file "+file+" !" );
+        }
+
+        // we parse front to back, so let the kernel read ahead aggressively
+        madvise( addr, mRawSize, MADV_SEQUENTIAL );
+
+        mRaw = static_cast< const char* >( addr );
+        mMapped = true;
+    }
+
+    // the mapping stays valid after closing the descriptor
+    if ( !isStdin )
+    {
+        close( fd );
+    }
+
+    if ( IsGzip( mRaw, mRawSize ) )
+    {
+        StartInflate();
+    }
+    else
+    {
+        mData = mRaw;
+        mSize = mRawSize;
+        mAvailable = mSize;
+    }
+}
+
+FieldFit::MappedFile::~MappedFile()
+{
+    if ( mProducer.joinable() )
+    {
+        mStopping = true;
+        mProducer.join();
+    }
+
+    if ( mReservation )
+    {
+        munmap( mReservation, mReserved );
+    }
+
+    if ( mMapped && mRaw )
+    {
+        munmap( const_cast< char* >( mRaw ), mRawSize );
+    }
+}
+
+void FieldFit::MappedFile::Reserve( size_t size )
+{
+    void *addr = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+
+    if ( addr == MAP_FAILED )
+    {
+        throw ArgException( "MappedFile", "MappedFile", "Unable to reserve memory to read file "+mName+" !" );
+    }
+
+    mReservation = static_cast< char* >( addr );
+    mReserved = size;
+    mData = mReservation;
+    mComplete = false;
+}
+
+void FieldFit::MappedFile::StartStream( const int fd, bool closeFd )
+{
+    // the length of a stream is not known, only pages that are written take memory
+    Reserve( gMaxReservation );
+
+    mProducer = std::thread( &MappedFile::ReadStream, this, fd, closeFd );
+}
+
+void FieldFit::MappedFile::ReadStream( const int fd, bool closeFd )
+{
+    size_t size = 0;
+    ssize_t count = 1;
+
+    // the first bytes tell whether the stream is compressed, nothing is published before
+    while ( size < 2 && ( count = ReadSome( fd, mReservation + size, gInflateChunk ) ) > 0 )
+    {
+        size += count;
+    }
+
+    if ( count > 0 && IsGzip( mReservation, size ) )
+    {
+        // the compressed bytes make way for the decompressed contents
+        mBuffer.assign( mReservation, mReservation + size );
+        mBuffer.resize( std::max( size, gInflateChunk ) );
+        mRawSize = size;
+
+        Inflate( fd );
+    }
+    else
+    {
+        while ( count > 0 )
+        {
+            {
+                std::lock_guard< std::mutex > lock( mMutex );
+                mAvailable = size;
+            }
+
+            mCondition.notify_all();
+
+            if ( size == mReserved )
+            {
+                count = -1;
+                break;
+            }
+
+            count = ReadSome( fd, mReservation + size, std::min( mReserved - size, gInflateChunk ) );
+            size += std::max< ssize_t >( count, 0 );
+        }
+
+        Complete( size, count < 0 && !mStopping ? "Unable to read file "+mName+" !" : "" );
+    }
+
+    if ( closeFd )
+    {
+        close( fd );
+    }
+}
+
+ssize_t FieldFit::MappedFile::ReadSome( const int fd, char *buffer, size_t count ) const
+{
+    // a stalled producer must not keep the destructor waiting
+    while ( !mStopping )
+    {
+        pollfd request = { fd, POLLIN, 0 };
+        const int ready = poll( &request, 1, gPollMilliseconds );
+
+        if ( ready < 0 && errno != EINTR )
+        {
+            return -1;
+        }
+
+        if ( ready <= 0 )
+        {
+            continue;
+        }
+
+        const ssize_t result = read( fd, buffer, count );
+
+        if ( result < 0 && ( errno == EINTR || errno == EAGAIN ) )
+        {
+            continue;
+        }
+
+        return result;
+    }
+
+    return 0;
+}
+
+void FieldFit::MappedFile::StartInflate()
+{
+    // the contents never move while they are parsed, so only address space is reserved up front
+    try
+    {
+        Reserve( std::min( mRawSize * gMaxCompressionRatio + gInflateChunk, gMaxReservation ) );
+    }
+    catch ( ... )
+    {
+        if ( mMapped )
+        {
+            munmap( const_cast< char* >( mRaw ), mRawSize );
+        }
+
+        throw;
+    }
+
+    mProducer = std::thread( &MappedFile::Inflate, this, -1 );
+}
+
+void FieldFit::MappedFile::Inflate( const int fd )
+{
+    z_stream stream;
+    stream.zalloc = Z_NULL;
+    stream.zfree = Z_NULL;
+    stream.opaque = Z_NULL;
+    stream.next_in = reinterpret_cast< Bytef* >( fd < 0 ? const_cast< char* >( mRaw ) : mBuffer.data() );
+    stream.avail_in = fd < 0 ? 0 : static_cast< uInt >( mRawSize );
+
+    // 32 detects the gzip header
+    S32 status = inflateInit2( &stream, 15 + 32 );
+
+    const char *input = mRaw, *inputEnd = mRaw + mRawSize;
+    bool atEnd = false, readError = false;
+    size_t size = 0;
+
+    // hands zlib the next piece of input, false once there is none left
+    auto refill = [&]()
+    {
+        // zlib counts in 32 bits, so large inputs are fed piecewise
+        if ( fd < 0 )
+        {
+            stream.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( input ) );
+            stream.avail_in = static_cast< uInt >( std::min< size_t >( inputEnd - input, gInflateChunk ) );
+            input += stream.avail_in;
+
+            return stream.avail_in > 0;
+        }
+
+        const ssize_t count = ReadSome( fd, mBuffer.data(), mBuffer.size() );
+        readError = count < 0;
+
+        stream.next_in = reinterpret_cast< Bytef* >( mBuffer.data() );
+        stream.avail_in = static_cast< uInt >( std::max< ssize_t >( count, 0 ) );
+
+        return count > 0;
+    };
+
+    while ( status == Z_OK && !mStopping )
+    {
+        if ( stream.avail_in == 0 && !atEnd )
+        {
+            atEnd = !refill();
+        }
+
+        if ( size == mReserved )
+        {
+            status = Z_BUF_ERROR;
+            break;
+        }
+
+        stream.next_out = reinterpret_cast< Bytef* >( mReservation + size );
+        stream.avail_out = static_cast< uInt >( std::min( mReserved - size, gInflateChunk ) );
+
+        const size_t before = stream.avail_out;
+        status = inflate( &stream, Z_NO_FLUSH );
+        size += before - stream.avail_out;
+
+        if ( status == Z_STREAM_END )
+        {
+            if ( stream.avail_in == 0 && !atEnd )
+            {
+                atEnd = !refill();
+            }
+
+            // concatenated gzip members form a single file
+            if ( stream.avail_in > 0 )
+            {
+                status = inflateReset( &stream );
+            }
+        }
+        else if ( status == Z_BUF_ERROR && stream.avail_in == 0 && atEnd )
+        {
+            // the input stopped in the middle of a member
+            break;
+        }
+        else if ( status == Z_BUF_ERROR )
+        {
+            status = Z_OK;
+        }
+
+        {
+            std::lock_guard< std::mutex > lock( mMutex );
+            mAvailable = size;
+        }
+
+        mCondition.notify_all();
+    }
+
+    const std::string message = readError ? "read error" : stream.msg ? stream.msg : "truncated or corrupt data";
+    inflateEnd( &stream );
+
+    // the compressed input is no longer needed
+    if ( mMapped )
+    {
+        munmap( const_cast< char* >( mRaw ), mRawSize );
+        mRaw = nullptr;
+    }
+    else
+    {
+        std::vector< char >().swap( mBuffer );
+    }
+
+    Complete( size, status != Z_STREAM_END && !mStopping ? "Unable to decompress file "+mName+": "+message : "" );
+}
+
+void FieldFit::MappedFile::Complete( size_t size, const std::string &error )
+{
+    {
+        std::lock_guard< std::mutex > lock( mMutex );
+
+        mError = error;
+        mSize = size;
+        mAvailable = size;
+        mComplete = true;
+    }
+
+    mCondition.notify_all();
+}
+
+const char *FieldFit::MappedFile::Data() const
+{
+    return mData;
+}
+
+const char *FieldFit::MappedFile::End() const
+{
+    return mData + Size();
+}
+
+size_t FieldFit::MappedFile::Size() const
+{
+    if ( !mComplete )
+    {
+        std::unique_lock< std::mutex > lock( mMutex );
+        mCondition.wait( lock, [this]() { return mComplete.load(); } );
+    }
+
+    return Available( mSize );
+}
+
+size_t FieldFit::MappedFile::Available( size_t offset ) const
+{
+    if ( !mComplete )
+    {
+        std::unique_lock< std::mutex > lock( mMutex );
+        mCondition.wait( lock, [this, offset]() { return mComplete || mAvailable > offset; } );
+    }
+
+    if ( mComplete && !mError.empty() )
+    {
+        throw ArgException( "MappedFile", "MappedFile", mError );
+    }
+
+    return mAvailable;
+}
+
+void FieldFit::MappedFile::Release( const char *begin, const char *end ) const
+{
+    // pages of a reservation are zero once dropped, so only contents that were written may go
+    if ( mReservation ? end > mData + mAvailable : !mMapped )
+    {
+        return;
+    }
+
+    const uintptr_t pageSize = sysconf( _SC_PAGESIZE );
+
+    // pages shared with a neighbouring range stay resident
+    const uintptr_t first = ( reinterpret_cast< uintptr_t >( begin ) + pageSize - 1 ) / pageSize * pageSize;
+    const uintptr_t last = reinterpret_cast< uintptr_t >( end ) / pageSize * pageSize;
+
+    if ( first < last )
+    {
+        madvise( reinterpret_cast< void* >( first ), last - first, MADV_DONTNEED );
+    }
+}
+
+const std::string &FieldFit::MappedFile::GetName() const
+{
+    return mName;
+}
@@ -0,0 +1,212 @@
+#include "io/npyArray.h"
+#include "io/block.h"
+#include "io/mappedFile.h"
+#include "io/tokenStream.h"
+#include "io/numberParser.h"
+
+#include "common/util.h"
+#include "common/exception.h"
+
+#include <cstring>
+
+namespace
+{
+    const char gMagic[] = "\x93NUMPY";
+    const size_t gMagicSize = 6;
+
+    bool EndsWith( const std::string &token, const std::string &suffix )
+    {
+        return token.size() > suffix.size() && token.compare( token.size() - suffix.size(), suffix.size(), suffix ) == 0;
+    }
+
+    // the value of a key in the header dictionary, e.g. '<f8' for {'descr': '<f8', ... }
+    std::string HeaderValue( const std::string &header, const std::string &key, const std::string &file )
+    {
+        size_t begin = header.find( "'" + key + "'" );
+
+        if ( begin == std::string::npos || ( begin = header.find( ':', begin ) ) == std::string::npos )
+        {
+            throw FieldFit::ArgException( "FieldFit", "NpyArray", "npy file "+file+" has no "+key+" in its header" );
+        }
+
+        begin = header.find_first_not_of( " ", begin + 1 );
+
+        size_t end = std::string::npos;
+
+        if ( begin != std::string::npos && header[ begin ] == '(' )
+        {
+            end = header.find( ')', begin );
+        }
+        else if ( begin != std::string::npos && header[ begin ] == '\'' )
+        {
+            end = header.find( '\'', begin + 1 );
+        }
+        else if ( begin != std::string::npos && ( end = header.find_first_of( ",}", begin ) ) != std::string::npos )
+        {
+            --end;
+        }
+
+        if ( end == std::string::npos )
+        {
+            throw FieldFit::ArgException( "FieldFit", "NpyArray", "npy file "+file+" has a malformed header" );
+        }
+
+        return Util::Trim( header.substr( begin, end + 1 - begin ) );
+    }
+}
+
+FieldFit::NpyArray::NpyArray( const std::string &file ) :
+    mFile( std::make_shared< const MappedFile >( file ) ), mData( nullptr ), mFortranOrder( false )
+{
+    const char *data = mFile->Data();
+    const size_t size = mFile->Size();
+
+    if ( size < 10 || memcmp( data, gMagic, gMagicSize ) != 0 )
+    {
+        throw ArgException( "FieldFit", "NpyArray", "file "+file+" is not a npy file" );
+    }
+
+    const U32 major = static_cast< unsigned char >( data[6] );
+
+    // the header length is stored little endian, in 2 bytes for version 1 and 4 bytes after
+    size_t headerSize = 0;
+    size_t offset = major == 1 ? 10 : 12;
+
+    if ( ( major != 1 && major != 2 && major != 3 ) || size < offset )
+    {
+        throw ArgException( "FieldFit", "NpyArray", "npy file "+file+" has unsupported version "+Util::ToString( major ) );
+    }
+
+    for ( size_t b = offset; b > 8; --b )
+    {
+        headerSize = ( headerSize << 8 ) | static_cast< unsigned char >( data[ b - 1 ] );
+    }
+
+    if ( headerSize > size - offset )
+    {
+        throw ArgException( "FieldFit", "NpyArray", "npy file "+file+" is truncated" );
+    }
+
+    const std::string header( data + offset, headerSize );
+    offset += headerSize;
+
+    const std::string descr = HeaderValue( header, "descr", file );
+
+    if ( descr != "'<f8'" )
+    {
+        throw ArgException( "FieldFit", "NpyArray", "npy file "+file+" holds "+descr+" values, only little endian float64 ( '<f8' ) is supported" );
+    }
+
+    mFortranOrder = HeaderValue( header, "fortran_order", file ) == "True";
+
+    // e.g. (2000, 3) or (2000,)
+    const std::string shape = HeaderValue( header, "shape", file );
+    size_t numValues = 1;
+
+    for ( size_t begin = 1, end; begin < shape.size(); begin = end + 1 )
+    {
+        end = shape.find_first_of( ",)", begin );
+
+        const std::string dim = Util::Trim( shape.substr( begin, end - begin ) );
+        U64 value;
+
+        if ( dim.empty() )
+        {
+            continue;
+        }
+
+        if ( !NumberParser::Parse( dim.data(), dim.data() + dim.size(), value ) )
+        {
+            throw ArgException( "FieldFit", "NpyArray", "npy file "+file+" has a malformed shape "+shape );
+        }
+
+        mShape.push_back( value );
+        numValues *= value;
+    }
+
+    if ( mShape.empty() || mShape.size() > 2 )
+    {
+        throw ArgException( "FieldFit", "NpyArray", "npy file "+file+" has shape "+shape+", only one or two dimensions are supported" );
+    }
+
+    // numpy pads the header so that the values are aligned
+    if ( offset % sizeof( F64 ) != 0 || ( size - offset ) / sizeof( F64 ) < numValues )
+    {
+        throw ArgException( "FieldFit", "NpyArray", "npy file "+file+" is truncated or misaligned" );
+    }
+
+    mData = reinterpret_cast< const F64* >( data + offset );
+}
+
+std::string FieldFit::NpyArray::Reference( const Block &block )
+{
+    if ( block.HasPayload() || !block.BodyBegin() )
+    {
+        return "";
+    }
+
+    TokenStream stream( block );
+
+    if ( stream.AtEnd() )
+    {
+        return "";
+    }
+
+    // a numeric body never gets past the first token
+    const std::string token = stream.NextToken();
+
+    if ( !stream.AtEnd() || !( EndsWith( token, ".npy" ) || EndsWith( token, ".npy.gz" ) ) )
+    {
+        return "";
+    }
+
+    // relative to the directory of the file that holds the block, stdin has none
+    const size_t slash = block.GetFile().rfind( '/' );
+
+    if ( token[0] == '/' || slash == std::string::npos )
+    {
+        return token;
+    }
+
+    return block.GetFile().substr( 0, slash + 1 ) + token;
+}
+
+bool FieldFit::NpyArray::HasShape( size_t rows, size_t cols ) const
+{
+    if ( mShape.size() == 1 )
+    {
+        return mShape[0] == rows && cols == 1;
+    }
+
+    return mShape[0] == rows && mShape[1] == cols;
+}
+
+bool FieldFit::NpyArray::IsColumnMajor() const
+{
+    return mFortranOrder || mShape.size() == 1 || mShape[1] == 1;
+}
+
+const F64 *FieldFit::NpyArray::Data() const
+{
+    return mData;
+}
+
+F64 FieldFit::NpyArray::At( size_t row, size_t col ) const
+{
+    if ( mShape.size() == 1 )
+    {
+        return mData[ row ];
+    }
+
+    return mFortranOrder ? mData[ row + col * mShape[0] ] : mData[ row * mShape[1] + col ];
+}
+
+std::shared_ptr< const void > FieldFit::NpyArray::GetSource() const
+{
+    return mFile;
+}
+
+const std::string &FieldFit::NpyArray::GetName() const
+{
+    return mFile->GetName();
+}
@@ -0,0 +1,338 @@
+#include "io/numberParser.h"
+
+#include <limits>
+#include <string>
+#include <cstring>
+#include <stdlib.h>
+
+namespace
+{
+    // all powers of ten that are exactly representable in a double
+    const F64 gPowersF64[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+
+    // all powers of ten that are exactly representable in a 64 bit mantissa ( 5^27 < 2^64 )
+    const long double gPowersExt[] = {
+        1e0L,  1e1L,  1e2L,  1e3L,  1e4L,  1e5L,  1e6L,  1e7L,  1e8L,  1e9L,
+        1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+        1e20L, 1e21L, 1e22L, 1e23L, 1e24L, 1e25L, 1e26L, 1e27L
+    };
+
+    const U64 gMaxExactMantissa = U64( 1 ) << 53;
+    const S32 gMaxSignificantDigits = 19;
+
+    // x87 extended precision, where the first 8 bytes hold the full 64 bit significand
+    const bool gHasExtendedPrecision = std::numeric_limits< long double >::digits == 64 &&
+                                       sizeof( long double ) >= sizeof( U64 );
+
+    struct Decimal
+    {
+        U64 mantissa;
+        S32 exponent;
+        bool negative;
+        bool truncated;
+    };
+
+    inline bool IsDigit( const char c )
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    inline bool IsExponent( const char c )
+    {
+        return c == 'e' || c == 'E' || c == 'd' || c == 'D';
+    }
+
+    /*
+    **  Validates the syntax and collects up to 19 significant digits,
+    **  value = mantissa * 10^exponent
+    */
+    bool ScanDecimal( const char *begin, const char *end, Decimal &dec )
+    {
+        const char *it = begin;
+
+        dec.mantissa = 0;
+        dec.exponent = 0;
+        dec.negative = false;
+        dec.truncated = false;
+
+        if ( it != end && ( *it == '-' || *it == '+' ) )
+        {
+            dec.negative = *it == '-';
+            ++it;
+        }
+
+        S32 digits = 0;
+        bool anyDigit = false;
+
+        for ( ; it != end && IsDigit( *it ); ++it )
+        {
+            const U32 d = *it - '0';
+            anyDigit = true;
+
+            if ( dec.mantissa == 0 && d == 0 )
+            {
+                continue;
+            }
+
+            if ( digits < gMaxSignificantDigits )
+            {
+                dec.mantissa = dec.mantissa * 10 + d;
+                ++digits;
+            }
+            else
+            {
+                dec.exponent++;
+                dec.truncated |= d != 0;
+            }
+        }
+
+        if ( it != end && *it == '.' )
+        {
+            for ( ++it; it != end && IsDigit( *it ); ++it )
+            {
+                const U32 d = *it - '0';
+                anyDigit = true;
+
+                if ( dec.mantissa == 0 && d == 0 )
+                {
+                    dec.exponent--;
+                }
+                else if ( digits < gMaxSignificantDigits )
+                {
+                    dec.mantissa = dec.mantissa * 10 + d;
+                    dec.exponent--;
+                    ++digits;
+                }
+                else
+                {
+                    dec.truncated |= d != 0;
+                }
+            }
+        }
+
+        if ( !anyDigit )
+        {
+            return false;
+        }
+
+        if ( it != end && IsExponent( *it ) )
+        {
+            ++it;
+
+            bool negative = false;
+
+            if ( it != end && ( *it == '-' || *it == '+' ) )
+            {
+                negative = *it == '-';
+                ++it;
+            }
+
+            if ( it == end || !IsDigit( *it ) )
+            {
+                return false;
+            }
+
+            S32 exponent = 0;
+
+            for ( ; it != end && IsDigit( *it ); ++it )
+            {
+                // anything beyond this over- or underflows anyway
+                if ( exponent < 100000 )
+                {
+                    exponent = exponent * 10 + ( *it - '0' );
+                }
+            }
+
+            dec.exponent += negative ? -exponent : exponent;
+        }
+
+        return it == end;
+    }
+
+    /*
+    **  Slow but always correctly rounded path
+    */
+    F64 ParseFallback( const char *begin, const char *end )
+    {
+        char buffer[128];
+        std::string large;
+
+        const size_t length = end - begin;
+        char *str = buffer;
+
+        if ( length >= sizeof( buffer ) )
+        {
+            large.resize( length + 1 );
+            str = &large[0];
+        }
+
+        for ( size_t i=0; i < length; ++i )
+        {
+            // strtod does not know about Fortran double precision exponents
+            str[i] = ( begin[i] == 'd' || begin[i] == 'D' ) ? 'e' : begin[i];
+        }
+
+        str[length] = '\0';
+
+        return strtod( str, nullptr );
+    }
+
+    /*
+    **  A single extended precision operation is within half an extended ulp of the exact
+    **  result, so rounding it to double is only ambiguous when it lies exactly halfway
+    **  between two doubles ( the 11 extra significand bits are 10000000000b ).
+    */
+    bool ConvertExtended( const Decimal &dec, F64 &value )
+    {
+        const long double mantissa = static_cast< long double >( dec.mantissa );
+        const long double result = dec.exponent < 0 ? mantissa / gPowersExt[ -dec.exponent ] :
+                                                      mantissa * gPowersExt[ dec.exponent ];
+
+        U64 significand;
+        memcpy( &significand, &result, sizeof( U64 ) );
+
+        if ( ( significand & 0x7FF ) == 0x400 )
+        {
+            return false;
+        }
+
+        value = static_cast< F64 >( result );
+
+        return true;
+    }
+
+    template< class T >
+    bool ParseUnsigned( const char *begin, const char *end, T &value )
+    {
+        const char *it = begin;
+
+        if ( it != end && *it == '+' )
+        {
+            ++it;
+        }
+
+        if ( it == end )
+        {
+            return false;
+        }
+
+        T result = 0;
+
+        for ( ; it != end; ++it )
+        {
+            if ( !IsDigit( *it ) )
+            {
+                return false;
+            }
+
+            const T d = *it - '0';
+
+            if ( result > ( std::numeric_limits< T >::max() - d ) / 10 )
+            {
+                return false;
+            }
+
+            result = result * 10 + d;
+        }
+
+        value = result;
+
+        return true;
+    }
+}
+
+bool FieldFit::NumberParser::Parse( const char *begin, const char *end, F64 &value )
+{
+    Decimal dec;
+
+    if ( !ScanDecimal( begin, end, dec ) )
+    {
+        return false;
+    }
+
+    if ( dec.mantissa == 0 )
+    {
+        value = dec.negative ? -0.0 : 0.0;
+        return true;
+    }
+
+    if ( !dec.truncated )
+    {
+        // both operands are exact, so a single operation is correctly rounded
+        if ( dec.mantissa <= gMaxExactMantissa && dec.exponent >= -22 && dec.exponent <= 22 )
+        {
+            const F64 mantissa = static_cast< F64 >( dec.mantissa );
+            value = dec.exponent < 0 ? mantissa / gPowersF64[ -dec.exponent ] :
+                                       mantissa * gPowersF64[ dec.exponent ];
+            value = dec.negative ? -value : value;
+            return true;
+        }
+
+        // typical for the 18 digit output of QM codes
+        if ( gHasExtendedPrecision && dec.exponent >= -27 && dec.exponent <= 27 && ConvertExtended( dec, value ) )
+        {
+            value = dec.negative ? -value : value;
+            return true;
+        }
+    }
+
+    value = ParseFallback( begin, end );
+
+    return true;
+}
+
+bool FieldFit::NumberParser::Parse( const char *begin, const char *end, F32 &value )
+{
+    F64 result;
+
+    if ( !Parse( begin, end, result ) )
+    {
+        return false;
+    }
+
+    value = static_cast< F32 >( result );
+
+    return true;
+}
+
+bool FieldFit::NumberParser::Parse( const char *begin, const char *end, U32 &value )
+{
+    return ParseUnsigned( begin, end, value );
+}
+
+bool FieldFit::NumberParser::Parse( const char *begin, const char *end, U64 &value )
+{
+    return ParseUnsigned( begin, end, value );
+}
+
+bool FieldFit::NumberParser::Parse( const char *begin, const char *end, S32 &value )
+{
+    const bool negative = begin != end && *begin == '-';
+
+    if ( negative && begin + 1 != end && begin[1] == '+' )
+    {
+        return false;
+    }
+
+    U64 magnitude;
+
+    if ( !ParseUnsigned( negative ? begin + 1 : begin, end, magnitude ) )
+    {
+        return false;
+    }
+
+    const U64 limit = negative ? U64( std::numeric_limits< S32 >::max() ) + 1 :
+                                 U64( std::numeric_limits< S32 >::max() );
+
+    if ( magnitude > limit )
+    {
+        return false;
+    }
+
+    value = negative ? static_cast< S32 >( -S64( magnitude ) ) : static_cast< S32 >( magnitude );
+
+    return true;
+}
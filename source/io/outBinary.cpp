@@ -0,0 +1,380 @@
+#include "io/block.h"
+#include "io/npyArray.h"
+#include "io/outBinary.h"
+#include "io/tokenStream.h"
+#include "io/blockParser.h"
+#include "io/binaryFormat.h"
+
+#include "common/util.h"
+#include "common/exception.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace
+{
+    using namespace FieldFit;
+
+    struct BinaryRecord
+    {
+        std::vector< std::string > tokens;
+        std::vector< F64 > payload;
+        U64 rows;
+        U64 cols;
+    };
+
+    void TestSize( const Block &block, size_t expected )
+    {
+        if ( block.Size() != expected )
+        {
+            throw ArgException( "FieldFit", "WriteBinary", "block ["+block.GetTitle()+"] did not have the right amount of arguments based on the size indicator!" );
+        }
+    }
+
+    void TestEnd( const Block &block, TokenStream &stream )
+    {
+        if ( !stream.AtEnd() )
+        {
+            throw ArgException( "FieldFit", "WriteBinary", "block ["+block.GetTitle()+"] did not have the right amount of arguments based on the size indicator!" );
+        }
+    }
+
+    /*
+    **  Gathers numRows rows of interleaved values into a column major payload, the row i starts at
+    **  token start + i * stride and column c is found at offset columns[c].first within the row.
+    */
+    void GatherColumns( const Block &block, U32 start, U32 numRows, U32 stride,
+                        const std::vector< std::pair< U32, F64 > > &columns, BinaryRecord &record )
+    {
+        record.rows = numRows;
+        record.cols = columns.size();
+        record.payload.resize( record.rows * record.cols );
+
+        for ( size_t c=0; c < columns.size(); ++c )
+        {
+            F64 *column = record.payload.data() + c * numRows;
+
+            for ( U32 i=0; i < numRows; ++i )
+            {
+                column[i] = block.GetValue< F64 >( start + i * stride + columns[c].first ) * columns[c].second;
+            }
+        }
+    }
+
+    // copies a referenced npy array of record.rows x record.cols values into the payload
+    void GatherNpy( const Block &block, const NpyArray &array, F64 conv, BinaryRecord &record )
+    {
+        if ( !array.HasShape( record.rows, record.cols ) )
+        {
+            throw ArgException( "FieldFit", "WriteBinary", "npy file "+array.GetName()+" of block ["+block.GetTitle()+"] does not match its size indicators !" );
+        }
+
+        for ( size_t c=0; c < record.cols; ++c )
+        {
+            for ( size_t i=0; i < record.rows; ++i )
+            {
+                record.payload[ c * record.rows + i ] = array.At( i, c ) * conv;
+            }
+        }
+    }
+
+    void ConvertSystem( const Block &block, const Units &units, BinaryRecord &record )
+    {
+        const U32 numSites = block.GetValue< U32 >( 1 );
+
+        TestSize( block, 2 + numSites * 6 );
+
+        record.tokens.push_back( block.GetToken( 0 )->GetToken() );
+        record.tokens.push_back( block.GetToken( 1 )->GetToken() );
+
+        for ( U32 i=0; i < numSites; ++i )
+        {
+            for ( U32 t=0; t < 3; ++t )
+            {
+                record.tokens.push_back( block.GetToken( 2 + i * 6 + t )->GetToken() );
+            }
+        }
+
+        const F64 coordConv = units.GetCoordConv();
+
+        GatherColumns( block, 2, numSites, 6, { { 3, coordConv }, { 4, coordConv }, { 5, coordConv } }, record );
+    }
+
+    void ConvertGrid( const Block &block, const Units &units, BinaryRecord &record )
+    {
+        const U32 numCoords = block.GetValue< U32 >( 1 );
+
+        record.tokens.push_back( block.GetToken( 0 )->GetToken() );
+        record.tokens.push_back( block.GetToken( 1 )->GetToken() );
+
+        const F64 coordConv = units.GetCoordConv();
+
+        record.rows = numCoords;
+        record.cols = 3;
+        record.payload.resize( record.rows * record.cols );
+
+        const std::string npyFile = NpyArray::Reference( block );
+
+        if ( !npyFile.empty() )
+        {
+            GatherNpy( block, NpyArray( npyFile ), coordConv, record );
+
+            return;
+        }
+
+        TokenStream stream( block );
+
+        for ( U32 i=0; i < numCoords; ++i )
+        {
+            for ( U32 c=0; c < 3; ++c )
+            {
+                record.payload[ c * numCoords + i ] = stream.NextValue< F64 >() * coordConv;
+            }
+        }
+
+        TestEnd( block, stream );
+    }
+
+    void ConvertField( const Block &block, const Units &units, BinaryRecord &record )
+    {
+        if ( block.Size() < 3 )
+        {
+            throw ArgException( "FieldFit", "WriteBinary", "block ["+block.GetTitle()+"] was too small ( at least 3 arguments expected ) !" );
+        }
+
+        const U32 numSets   = block.GetValue< U32 >( 1 );
+        const U32 numPoints = block.GetValue< U32 >( 2 );
+
+        for ( U32 t=0; t < 3; ++t )
+        {
+            record.tokens.push_back( block.GetToken( t )->GetToken() );
+        }
+
+        // the sets are stored one after the other, which already is column major
+        const F64 potConv = units.GetPotConv();
+
+        record.rows = numPoints;
+        record.cols = numSets;
+        record.payload.resize( record.rows * record.cols );
+
+        const std::string npyFile = NpyArray::Reference( block );
+
+        if ( !npyFile.empty() )
+        {
+            GatherNpy( block, NpyArray( npyFile ), potConv, record );
+
+            return;
+        }
+
+        TokenStream stream( block );
+
+        for ( size_t i=0; i < record.payload.size(); ++i )
+        {
+            record.payload[i] = stream.NextValue< F64 >() * potConv;
+        }
+
+        TestEnd( block, stream );
+    }
+
+    void ConvertEfield( const Block &block, const Units &units, BinaryRecord &record )
+    {
+        if ( block.Size() < 3 )
+        {
+            throw ArgException( "FieldFit", "WriteBinary", "block ["+block.GetTitle()+"] was too small ( at least 3 arguments expected ) !" );
+        }
+
+        const U32 sites       = block.GetValue< U32 >( 1 );
+        const U32 setsPerSite = block.GetValue< U32 >( 2 );
+
+        for ( U32 t=0; t < 3; ++t )
+        {
+            record.tokens.push_back( block.GetToken( t )->GetToken() );
+        }
+
+        // one column per site holding ex, ey, ez for every set
+        const F64 efieldConv = units.GetEfieldConv();
+
+        record.rows = 3 * setsPerSite;
+        record.cols = sites;
+        record.payload.resize( record.rows * record.cols );
+
+        TokenStream stream( block );
+
+        for ( U32 i=0; i < sites; ++i )
+        {
+            record.tokens.push_back( stream.NextToken() );
+
+            for ( U32 r=0; r < record.rows; ++r )
+            {
+                record.payload[ i * record.rows + r ] = stream.NextValue< F64 >() * efieldConv;
+            }
+        }
+
+        TestEnd( block, stream );
+    }
+
+    void ConvertPermCharges( const Block &block, const Units &units, BinaryRecord &record )
+    {
+        const U32 permSites = block.GetValue< U32 >( 1 );
+
+        TestSize( block, 2 + permSites * 4 );
+
+        record.tokens.push_back( block.GetToken( 0 )->GetToken() );
+        record.tokens.push_back( block.GetToken( 1 )->GetToken() );
+
+        const F64 coordConv  = units.GetCoordConv();
+        const F64 chargeConv = units.GetChargeConv();
+
+        GatherColumns( block, 2, permSites, 4, { { 0, coordConv }, { 1, coordConv }, { 2, coordConv },
+                                                 { 3, chargeConv } }, record );
+    }
+
+    void ConvertPermDipoles( const Block &block, const Units &units, BinaryRecord &record )
+    {
+        const U32 permSites = block.GetValue< U32 >( 1 );
+
+        TestSize( block, 2 + permSites * 6 );
+
+        record.tokens.push_back( block.GetToken( 0 )->GetToken() );
+        record.tokens.push_back( block.GetToken( 1 )->GetToken() );
+
+        const F64 coordConv  = units.GetCoordConv();
+        const F64 dipoleConv = units.GetDipoleConv();
+
+        GatherColumns( block, 2, permSites, 6, { { 0, coordConv }, { 1, coordConv }, { 2, coordConv },
+                                                 { 3, dipoleConv }, { 4, dipoleConv }, { 5, dipoleConv } }, record );
+    }
+
+    // blocks that already come from a binary container are taken over as they are
+    void CopyBinary( const Block &block, BinaryRecord &record )
+    {
+        for ( auto it = block.Begin(), itend = block.End(); it != itend; ++it )
+        {
+            record.tokens.push_back( it->GetToken() );
+        }
+
+        record.rows = block.PayloadRows();
+        record.cols = block.PayloadCols();
+        record.payload.assign( block.GetPayload(), block.GetPayload() + record.rows * record.cols );
+    }
+
+    void Pad( std::ofstream &stream, U64 &offset, U64 target )
+    {
+        static const char zeros[ BinaryFormat::Alignment ] = {};
+
+        stream.write( zeros, target - offset );
+        offset = target;
+    }
+
+    void WriteRecord( std::ofstream &stream, const std::string &title, const BinaryRecord &binRecord, U64 &offset )
+    {
+        U64 tokenBytes = 0;
+
+        for ( const std::string &token : binRecord.tokens )
+        {
+            tokenBytes += sizeof( U32 ) + token.size();
+        }
+
+        BinaryFormat::Record record;
+        memset( &record, 0, sizeof( record ) );
+
+        // the record is zeroed, so the title stays terminated
+        memcpy( record.title, title.data(), std::min( title.size(), sizeof( record.title ) - 1 ) );
+        record.numTokens = binRecord.tokens.size();
+        record.rows = binRecord.rows;
+        record.cols = binRecord.cols;
+        record.payloadOffset = BinaryFormat::Align( offset + sizeof( record ) + tokenBytes );
+        record.nextOffset = BinaryFormat::Align( record.payloadOffset + binRecord.payload.size() * sizeof( F64 ) );
+
+        stream.write( reinterpret_cast< const char* >( &record ), sizeof( record ) );
+
+        for ( const std::string &token : binRecord.tokens )
+        {
+            const U32 length = token.size();
+
+            stream.write( reinterpret_cast< const char* >( &length ), sizeof( length ) );
+            stream.write( token.data(), length );
+        }
+
+        offset += sizeof( record ) + tokenBytes;
+        Pad( stream, offset, record.payloadOffset );
+
+        stream.write( reinterpret_cast< const char* >( binRecord.payload.data() ), binRecord.payload.size() * sizeof( F64 ) );
+
+        offset += binRecord.payload.size() * sizeof( F64 );
+        Pad( stream, offset, record.nextOffset );
+    }
+}
+
+size_t FieldFit::WriteBinary( const BlockParser &bp, const Units &units, const std::string &file )
+{
+    typedef void ( *Converter )( const Block &, const Units &, BinaryRecord & );
+
+    const std::vector< std::pair< std::string, Converter > > converters = {
+        { "SYSTEM",      &ConvertSystem },
+        { "GRID",        &ConvertGrid },
+        { "FIELD",       &ConvertField },
+        { "EFIELD",      &ConvertEfield },
+        { "PERMCHARGES", &ConvertPermCharges },
+        { "PERMDIPOLES", &ConvertPermDipoles }
+    };
+
+    BinaryFormat::Header header;
+    memset( &header, 0, sizeof( header ) );
+
+    memcpy( header.magic, BinaryFormat::Magic, sizeof( header.magic ) );
+    header.version = BinaryFormat::Version;
+    header.byteOrder = BinaryFormat::ByteOrder;
+
+    for ( const auto &converter : converters )
+    {
+        header.numRecords += bp.NumBlocks( converter.first );
+    }
+
+    std::ofstream stream( file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+
+    if ( !stream.is_open() )
+    {
+        throw ArgException( "FieldFit", "WriteBinary", "Unable to open file "+file+" for writing" );
+    }
+
+    stream.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+
+    U64 offset = sizeof( header );
+
+    for ( const auto &converter : converters )
+    {
+        for ( size_t i=0, numBlocks=bp.NumBlocks( converter.first ); i < numBlocks; ++i )
+        {
+            const Block block = bp.GetBlock( converter.first, i );
+
+            if ( block.Size() < 2 )
+            {
+                throw ArgException( "FieldFit", "WriteBinary", "block ["+converter.first+"] was too small ( at least 2 arguments expected ) !" );
+            }
+
+            // convert one block at a time, so we never hold more than a single payload
+            BinaryRecord record;
+
+            if ( block.HasPayload() )
+            {
+                CopyBinary( block, record );
+            }
+            else
+            {
+                converter.second( block, units, record );
+            }
+
+            WriteRecord( stream, converter.first, record, offset );
+        }
+    }
+
+    if ( !stream.good() )
+    {
+        throw ArgException( "FieldFit", "WriteBinary", "Failed writing to file "+file );
+    }
+
+    return header.numRecords;
+}
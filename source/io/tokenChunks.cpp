@@ -0,0 +1,75 @@
+#include "io/tokenChunks.h"
+
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+	// below this size a chunk is not worth a task
+	const size_t gMinChunkBytes = 1 << 20;
+}
+
+FieldFit::TokenChunks::TokenChunks( const Block &block, size_t expectedTokens, ThreadPool &pool ) :
+	mTitle( block.GetTitle() ), mHeaderSize( block.Size() ), mExpectedTokens( expectedTokens ), mPool( pool )
+{
+	const char *begin = block.BodyBegin(), *end = block.BodyEnd();
+	const size_t bytes = end - begin;
+
+	// a serial pool gains nothing from splitting, so it also skips the counting
+	const size_t numChunks = pool.NumThreads() == 1 ? 1 :
+	                         std::max< size_t >( std::min( pool.NumThreads() * 4, bytes / gMinChunkBytes ), 1 );
+
+	mBoundaries.push_back( begin );
+
+	for ( size_t c=1; c < numChunks; ++c )
+	{
+		const char *target = std::max( begin + c * ( bytes / numChunks ), mBoundaries.back() );
+
+		// the newline starts the next chunk, so comment lines are still recognized there
+		const char *newline = static_cast< const char* >( memchr( target, '\n', end - target ) );
+
+		if ( !newline )
+		{
+			break;
+		}
+
+		if ( newline != mBoundaries.back() )
+		{
+			mBoundaries.push_back( newline );
+		}
+	}
+
+	mBoundaries.push_back( end );
+
+	if ( mBoundaries.size() == 2 )
+	{
+		return;
+	}
+
+	std::vector< std::future< size_t > > counts;
+
+	for ( size_t c=0; c + 1 < mBoundaries.size(); ++c )
+	{
+		const char *chunkBegin = mBoundaries[c], *chunkEnd = mBoundaries[c+1];
+
+		counts.push_back( pool.Submit( [this, chunkBegin, chunkEnd]()
+		{
+			TokenStream stream( mTitle, chunkBegin, chunkEnd, 0 );
+
+			return stream.SkipAll();
+		} ) );
+	}
+
+	// the reader counts along, the tasks refer to this object so none may be left running by an error
+	for ( std::future< size_t > &count : counts )
+	{
+		pool.Wait( count );
+	}
+
+	mFirst.push_back( 0 );
+
+	for ( std::future< size_t > &count : counts )
+	{
+		mFirst.push_back( mFirst.back() + count.get() );
+	}
+}
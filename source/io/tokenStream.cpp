@@ -0,0 +1,130 @@
+#include "io/tokenStream.h"
+
+#include <ctype.h>
+#include <cstring>
+
+namespace
+{
+	// the same delimiters the BlockParser uses, plus the whitespace it trims from the lines
+	inline bool IsDelimiter( const char c )
+	{
+		return c == ' ' || c == '\t' || c == ';' || c == '\r' || c == '\v' || c == '\f';
+	}
+}
+
+FieldFit::TokenStream::TokenStream( const Block &block ) :
+	mTitle( block.GetTitle() ), mPosition( block.BodyBegin() ), mEnd( block.BodyEnd() ), mIndex( block.Size() )
+{
+}
+
+FieldFit::TokenStream::TokenStream( const std::string &title, const char *begin, const char *end, size_t index ) :
+	mTitle( title ), mPosition( begin ), mEnd( end ), mIndex( index )
+{
+}
+
+std::string FieldFit::TokenStream::NextToken()
+{
+	const char *begin, *end;
+	Next( begin, end );
+
+	return std::string( begin, end );
+}
+
+void FieldFit::TokenStream::Skip( size_t count )
+{
+	const char *begin, *end;
+
+	for ( size_t i=0; i < count; ++i )
+	{
+		Next( begin, end );
+	}
+}
+
+size_t FieldFit::TokenStream::SkipAll()
+{
+	const char *begin, *end;
+	size_t count = 0;
+
+	while ( Advance( begin, end ) )
+	{
+		++count;
+	}
+
+	return count;
+}
+
+bool FieldFit::TokenStream::AtEnd()
+{
+	SkipDelimiters();
+
+	return mPosition == mEnd;
+}
+
+size_t FieldFit::TokenStream::Index() const
+{
+	return mIndex;
+}
+
+void FieldFit::TokenStream::Next( const char *&begin, const char *&end )
+{
+	if ( !Advance( begin, end ) )
+	{
+		throw ArgException( "Block", "TokenStream", "block ["+mTitle+"] has fewer arguments than its size indicators promise !" );
+	}
+}
+
+bool FieldFit::TokenStream::Advance( const char *&begin, const char *&end )
+{
+	SkipDelimiters();
+
+	if ( mPosition == mEnd )
+	{
+		return false;
+	}
+
+	begin = mPosition;
+
+	while ( mPosition != mEnd && *mPosition != '\n' && !IsDelimiter( *mPosition ) )
+	{
+		++mPosition;
+	}
+
+	end = mPosition;
+	++mIndex;
+
+	return true;
+}
+
+void FieldFit::TokenStream::SkipDelimiters()
+{
+	while ( mPosition != mEnd )
+	{
+		if ( IsDelimiter( *mPosition ) )
+		{
+			++mPosition;
+		}
+		else if ( *mPosition == '\n' )
+		{
+			++mPosition;
+
+			// lines starting with a # are comments
+			const char *it = mPosition;
+
+			while ( it != mEnd && isspace( *it ) && *it != '\n' )
+			{
+				++it;
+			}
+
+			if ( it != mEnd && *it == '#' )
+			{
+				const char *lineEnd = static_cast< const char* >( memchr( it, '\n', mEnd - it ) );
+
+				mPosition = lineEnd ? lineEnd : mEnd;
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+}
@@ -1,30 +1,41 @@
 #include "io/tokenizer.h"
 
-void FieldFit::Tokenizer::Tokenize( const std::string &line, const std::string &delimiters )
+FieldFit::Tokenizer::Tokenizer( const std::string &delimiters )
 {
-	std::string::size_type position, lastPosition = 0;
+	for ( U32 i=0; i < 256; ++i )
+	{
+		mDelimiters[i] = false;
+	}
+	
+	for ( const char c : delimiters )
+	{
+		mDelimiters[ static_cast< unsigned char >( c ) ] = true;
+	}
+}
+
+void FieldFit::Tokenizer::Tokenize( const char *begin, const char *end )
+{
+	const char *position = begin, *lastPosition = begin;
 	
 	while( true )
 	{
-		position = line.find_first_of( delimiters, lastPosition );
-		
-		if ( position == std::string::npos )
+		while ( position != end && !mDelimiters[ static_cast< unsigned char >( *position ) ] )
 		{
-			position = line.length(); 
+			++position;
 		}
 		
 		//if we have at least a bit of data in between
 		if ( position != lastPosition )
 		{
-			mBuffer.push_back( line.substr( lastPosition, position - lastPosition ) );
+			mBuffer.push_back( Block::Token( lastPosition, position - lastPosition ) );
 		}	
 		
-		if ( position == line.length() )
+		if ( position == end )
 		{
 			break;	
 		}
 	
-		lastPosition = position + 1;
+		lastPosition = ++position;
 	}
 }
 
@@ -37,7 +48,7 @@ bool FieldFit::Tokenizer::IsEnd()
 {
 	if ( mBuffer.size() > 1 )
 	{
-		if ( mBuffer.back().compare("END") == 0 )
+		if ( mBuffer.back().Equals("END") )
 		{
 			mBuffer.pop_back();
 			
@@ -53,7 +64,7 @@ void FieldFit::Tokenizer::Empty()
 	mBuffer.clear();	
 }
 	
-const std::vector< std::string > & FieldFit::Tokenizer::GetBuffer()
+std::vector< FieldFit::Block::Token > & FieldFit::Tokenizer::GetBuffer()
 {
 	return mBuffer;
-}
\ No newline at end of file
+}
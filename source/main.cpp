@@ -1,13 +1,18 @@
 #include "common/util.h"
+#include "common/threadPool.h"
+#include "common/blasThreads.h"
 #include "common/exception.h"
 
 #include "io/block.h"
 #include "io/console.h"
 #include "io/inSystem.h"
+#include "io/outBinary.h"
 #include "io/blockParser.h"
+#include "io/mappedFile.h"
 #include "io/inConstraints.h"
 
 #include "fitting/fitter.h"
+#include "fitting/delcomp.h"
 
 #include "configuration/constraints.h"
 #include "configuration/configuration.h"
@@ -15,7 +20,7 @@
 #include <chrono>
 #include <string>
 #include <vector>
-#include <fstream>
+#include <sstream>
 #include <iostream>
 #include <algorithm>
 #include <tclap/CmdLine.h>
@@ -25,13 +30,10 @@ using namespace std::chrono;
 
 void ReadFilesFromList( const std::string &file, std::vector< std::string > &appList )
 {
-    std::ifstream stream;
-    stream.open( file.c_str(), std::ios::in );
-        
-    if ( !stream.is_open() )
-    {
-        throw ArgException( "::", "ReadFilesFromList", "Unable to open file "+file );
-    }
+    // lists can be compressed or piped just like the field files
+    const MappedFile list( file );
+    
+    std::istringstream stream( std::string( list.Data(), list.Size() ) );
         
     std::string line = "";
     while ( getline ( stream, line ) )
@@ -58,10 +60,24 @@ int main(int argc, char** argv)
     
     std::vector< U32 > collectionSelection;
     
+    std::string convertFile;
+    std::string kernelIsa;
+    
+    U32 numThreads = 0;
+    
     bool json = false;
     bool plain = false;
     bool debug = false;
     bool verbose = false;
+    bool gramTiles = false;
+    bool releaseCoefficients = false;
+    
+    bool mixedPrecision = false;
+    bool compactStorage = false;
+    bool blockSolver = false;
+    
+    F64 permTreeTheta = 0.0;
+    F64 refineTolerance = 0.0;
     
     Console console;
     auto t0 = high_resolution_clock::now();
@@ -74,13 +90,31 @@ int main(int argc, char** argv)
 	    TCLAP::SwitchArg verboseSwitch("v","verbose","Print verbose output", cmd, false);
         //TCLAP::SwitchArg plainSwitch("p","plain","Format output as plain", cmd, false);
         TCLAP::SwitchArg debugSwitch("d","debug","Debug print internal matrices", cmd, false); 
+        TCLAP::SwitchArg releaseSwitch("", "release-coefficients", "Free the coefficient matrices once the normal equations are built, chi2 is then computed from X'X, X'y and y'y", cmd, false);
+        TCLAP::SwitchArg gramTilesSwitch("", "gram-tiles", "Build X'X and X'y from cache sized tiles of the grid instead of storing the coefficient matrix", cmd, false);
         TCLAP::MultiArg<std::string> multiFileArg("f", "files", "File containing field-fit file names", false,"string" );
-        TCLAP::UnlabeledMultiArg<std::string> multi( "fieldFiles", "Generic input for field-files containing blocks", false,"string" );
+        TCLAP::UnlabeledMultiArg<std::string> multi( "fieldFiles", "Generic input for field-files containing blocks, - reads from stdin, named pipes are read in a single pass and gzip files are decompressed on the fly", false,"string" );
        
         TCLAP::MultiArg<U32> multiSelect("s", "select", "Select a column in the field files (counts for all!)", false,"U32" );
+        TCLAP::ValueArg<std::string> convertArg("c", "convert", "Convert the field files into a binary container with the given name instead of fitting", false, "", "string" );
 
         cmd.add( multiFileArg );
         cmd.add( multiSelect );
+        TCLAP::ValueArg<U32> threadsArg("t", "threads", "Number of threads used for reading the field files and their values (0 uses all cores)", false, 0, "U32" );
+        
+        TCLAP::SwitchArg mixedSwitch("", "mixed-precision", "Evaluate the coefficients in single precision, with twice the vector lanes, while X'X and X'y are still summed in double precision", cmd, false);
+        TCLAP::SwitchArg compactSwitch("", "compact-storage", "Keep the grids and potentials in single precision once a system is read, they are converted back per tile", cmd, false);
+        TCLAP::SwitchArg blockSolverSwitch("", "block-solver", "Factor the normal equations of every system and collection on their own, in parallel, and couple them through the constraints only, instead of one dense solve", cmd, false);
+        TCLAP::ValueArg<F64> refineArg("", "refine-tolerance", "Refine the solution against the double precision normal equations until its relative change drops below this (default 0: no refinement)", false, 0.0, "F64" );
+        TCLAP::ValueArg<F64> permTreeArg("", "perm-tree", "Approximate the permanent fields with an octree treecode of this opening angle, e.g. 0.5 (default 0: direct summation)", false, 0.0, "F64" );
+        
+        TCLAP::ValueArg<std::string> kernelIsaArg("", "kernel-isa", "Instruction set of the grid kernels: scalar, sse2, avx2 or avx512 (default: the widest the cpu supports)", false, "", "string" );
+        
+        cmd.add( convertArg );
+        cmd.add( threadsArg );
+        cmd.add( kernelIsaArg );
+        cmd.add( permTreeArg );
+        cmd.add( refineArg );
         
         //make sure this is last
         cmd.add(  multi );
@@ -90,11 +124,21 @@ int main(int argc, char** argv)
         fieldFiles = multi.getValue();
        
         collectionSelection = multiSelect.getValue();
+        convertFile = convertArg.getValue();
+        numThreads = threadsArg.getValue();
+        kernelIsa = kernelIsaArg.getValue();
+        permTreeTheta = permTreeArg.getValue();
+        refineTolerance = refineArg.getValue();
         std::sort( collectionSelection.begin(), collectionSelection.end() );
 
         //plain = plainSwitch.getValue();
         verbose = verboseSwitch.getValue();
         debug = debugSwitch.getValue();
+        gramTiles = gramTilesSwitch.getValue();
+        releaseCoefficients = releaseSwitch.getValue();
+        mixedPrecision = mixedSwitch.getValue();
+        compactStorage = compactSwitch.getValue();
+        blockSolver = blockSolverSwitch.getValue();
 	} 
     catch (TCLAP::ArgException &e)  // catch any exceptions
 	{ 
@@ -106,6 +150,13 @@ int main(int argc, char** argv)
     const Units *units = nullptr;
     Configuration config;
     Constraints   constr;
+    
+    // also used by the fitter, after the field files are read; declared after the configuration,
+    // so its workers are joined before the systems they may still be updating are deleted
+    ThreadPool pool( numThreads );
+    
+    // the part of the parsing the reader spent waiting for the normal equations of the systems
+    F64 updateSeconds = 0.0;
 
     try 
     {
@@ -115,20 +166,78 @@ int main(int argc, char** argv)
             ReadFilesFromList(f,fieldFiles);
         }
         
-        // Initiate reading of the field files
-        BlockParser bp(fieldFiles);
+        if ( !kernelIsa.empty() )
+        {
+            SetKernelIsa( StringToKernelIsa( kernelIsa ) );
+        }
+        
+        if ( verbose || !kernelIsa.empty() )
+        {
+            console.Warn( Message( "", "main", "Kernel instruction set: " + EnumToString( GetKernelIsa() ) ) );
+        }
+        
+        config.SetGramTiles( gramTiles );
+        config.SetReleaseCoefficients( releaseCoefficients );
+        config.SetPermTreeTheta( permTreeTheta );
+        config.SetMixedPrecision( mixedPrecision );
+        config.SetCompactStorage( compactStorage );
+        config.SetBlockSolver( blockSolver );
+        config.SetRefineTolerance( refineTolerance );
+        
+        // Initiate reading of the field files, the blocks are read while later files are still indexed
+        BlockParser bp( fieldFiles, pool );
+        
+        while ( bp.NumBlocks( "UNITS" ) == 0 && bp.MergeNext() )
+        {
+        }
+        
         units = ReadUnits( bp );
 
-        ReadSystems( bp, *units, config );
-        ReadGrids( bp, *units, config );
-        ReadFields( bp, *units, config, collectionSelection );
-        ReadEfields( bp, *units, config );
-        ReadPermChargeSets( bp, *units, config );
-        ReadPermDipoleSets( bp, *units, config );
+        if ( !convertFile.empty() )
+        {
+            bp.MergeAll();
+            
+            const size_t numBlocks = WriteBinary( bp, *units, convertFile );
+            console.Warn( Message( "", "main", "Converted " + Util::ToString( numBlocks ) + " blocks into " + convertFile ) );
+            
+            // conversion only, nothing to fit
+            valid_state = false;
+        }
+        else
+        {
+            // the normal equations of each system are built while the next ones are read
+            // the pool already runs systems and their chunks in parallel, so each BLAS call stays on its thread
+            const size_t blasThreads = SetBlasThreads( 1 );
+            updateSeconds = ReadAndUpdateSystems( bp, *units, config, collectionSelection, pool, 2 * pool.NumThreads() );
+            
+            // a second UNITS block in a later file was only merged by now
+            bp.GetBlock( "UNITS" );
+            
+            // the solve is a single large problem again
+            if ( blasThreads > 0 )
+            {
+                SetBlasThreads( blasThreads );
+            }
+            
+            if ( releaseCoefficients )
+            {
+                console.Warn( Message( "", "main", "Released coefficients (MB): " + Util::ToString( config.GetReleasedBytes() / F64( 1 << 20 ) ) ) );
+            }
+            
+            if ( permTreeTheta > 0.0 )
+            {
+                console.Warn( Message( "", "main", "Perm treecode max error on sampled grid points: " + Util::ToString( config.GetPermTreeError() ) ) );
+            }
 
-        // parse constraints
-        ReadSumConstraintSet( bp, *units, constr );
-        ReadSymConstraintSet( bp, *units, constr );
+            // parse constraints
+            ReadSumConstraintSet( bp, *units, constr );
+            ReadSymConstraintSet( bp, *units, constr );
+        }
+        
+        for ( const auto &parseTime : bp.GetParseTimes() )
+        {
+            console.Warn( Message( "", "main", "Parsing " + parseTime.first + " (seconds): " + Util::ToString( parseTime.second ) ) );
+        }
         
         //clean up after reading
         bp.Clear();
@@ -147,17 +256,8 @@ int main(int argc, char** argv)
     {
         if (valid_state)
         {
-            // start data generation
-            for ( FieldFit::System *sys : config.GetSystems() )
-            {
-                if (sys)
-                {
-                    sys->OnUpdate2();
-                }   
-            }
-
             Fitter fitter; 
-            fitter.Fit( console, config, constr, debug );
+            fitter.Fit( console, config, constr, pool, debug );
         }
     }
     catch (FieldFit::ArgException &e)  // catch any exceptions
@@ -167,7 +267,8 @@ int main(int argc, char** argv)
 
     auto t2 = high_resolution_clock::now();
     console.Warn( Message( "", "main", "Runtime (seconds): " + Util::ToString( (size_t)duration_cast<seconds>( t2 - t0).count() ) ) );
-    console.Warn( Message( "", "main", "Parsing (seconds): " + Util::ToString( (size_t)duration_cast<seconds>( t1 - t0).count() ) ) );
+    console.Warn( Message( "", "main", "Parsing (seconds): " + Util::ToString( (size_t)( duration_cast< duration< F64 > >( t1 - t0 ).count() - updateSeconds ) ) ) );
+    console.Warn( Message( "", "main", "Normal equations (seconds): " + Util::ToString( (size_t)updateSeconds ) ) );
     console.Warn( Message( "", "main", "Solving (seconds): " + Util::ToString( (size_t)duration_cast<seconds>( t2 - t1).count() ) ) );
 
     console.Write(std::cout, units, plain, verbose);